@@ -0,0 +1,345 @@
+#include "gpu/gpu_finder.h"
+#include "cpu/cpu_finder.h"
+#include "io/test_generator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// PatternMatchingBench [--format json|csv] [--repetitions N] [--warmup N] [--sizes N,...] [--alphabets N,...]
+//                      [--patterns N,...] [--lengths short,mixed,long] [--depths N,...]
+// A corpus is generated for every combination of the sweep, every engine is built on it and timed after
+// the warmup calls, so OpenCL setup and program builds aren't counted. One record per corpus and engine;
+// an engine that can't be built or fails is recorded with its error and ok false, never left out.
+
+namespace {
+
+    struct Sweep final {
+        std::vector<size_t> sizes{1 << 20, 1 << 24};
+        std::vector<size_t> alphabets{4, 26};
+        std::vector<size_t> patterns{100, 1000};
+        std::vector<std::string> lengths{"short", "mixed", "long"};
+        std::vector<size_t> depths{1, 16}; // patterns sharing a signature table cell
+        size_t repetitions = 5;
+        size_t warmup = 1;
+        bool csv = false;
+    };
+
+    struct Corpus final {
+        size_t size;
+        size_t alphabet;
+        size_t patterns;
+        std::string lengths;
+        size_t depth;
+    };
+
+    struct Engine final {
+        using Match = std::function<std::vector<size_t>(std::string_view)>;
+
+        std::string name;
+        Match match;
+        std::string error = {}; // why the engine couldn't be built, match is empty then
+    };
+
+    std::vector<std::string> SplitList(const std::string& list) {
+
+        std::vector<std::string> items;
+        std::istringstream in(list);
+        for (std::string item; std::getline(in, item, ',');)
+            if (!item.empty())
+                items.push_back(item);
+
+        if (items.empty())
+            throw std::invalid_argument("Empty list: " + list);
+        return items;
+    }
+
+    std::vector<size_t> SplitNumbers(const std::string& list) {
+
+        std::vector<size_t> numbers;
+        for (const auto& item : SplitList(list))
+            numbers.push_back(std::stoull(item));
+        return numbers;
+    }
+
+    Sweep ParseArgs(int argc, char** argv) {
+
+        Sweep sweep;
+        for (int i = 1; i < argc; ++i) {
+            if (i + 1 == argc)
+                throw std::invalid_argument(std::string("No value for ") + argv[i]);
+
+            const std::string option = argv[i], value = argv[++i];
+            if (option == "--format" && (value == "json" || value == "csv"))
+                sweep.csv = value == "csv";
+            else if (option == "--repetitions")
+                sweep.repetitions = std::max<size_t>(std::stoull(value), 1);
+            else if (option == "--warmup")
+                sweep.warmup = std::stoull(value);
+            else if (option == "--sizes")
+                sweep.sizes = SplitNumbers(value);
+            else if (option == "--alphabets")
+                sweep.alphabets = SplitNumbers(value);
+            else if (option == "--patterns")
+                sweep.patterns = SplitNumbers(value);
+            else if (option == "--lengths")
+                sweep.lengths = SplitList(value);
+            else if (option == "--depths")
+                sweep.depths = SplitNumbers(value);
+            else
+                throw std::invalid_argument("Unknown option: " + option + " " + value);
+        }
+        return sweep;
+    }
+
+    // pattern lengths of a distribution: short ones are counted by short_count, long ones by the signature tables
+    std::vector<size_t> GetLengths(const std::string& distribution, size_t count, std::mt19937& rng) {
+
+        size_t min = 0, max = 0;
+        if (distribution == "short")
+            min = 2, max = 5;
+        else if (distribution == "mixed")
+            min = 2, max = 16;
+        else if (distribution == "long")
+            min = 8, max = 32;
+        else
+            throw std::invalid_argument("Unknown length distribution: " + distribution);
+
+        std::uniform_int_distribution<size_t> length(min, max);
+        std::vector<size_t> lengths(count);
+        for (auto& len : lengths)
+            len = length(rng);
+        return lengths;
+    }
+
+    TestCase Generate(const Corpus& corpus) {
+
+        // lowercase letters for small alphabets, printable ASCII for bigger ones
+        if (!corpus.alphabet || corpus.alphabet > 94)
+            throw std::invalid_argument("Alphabet size must be within [1, 94]");
+        const char first = corpus.alphabet <= 26 ? 'a' : '!';
+        const char last = static_cast<char>(first + corpus.alphabet - 1);
+
+        // the same corpus for the same sweep point, so that builds are compared on equal data
+        std::mt19937 rng(static_cast<unsigned>(corpus.size ^ corpus.alphabet << 8 ^ corpus.patterns << 16 ^ corpus.depth << 24));
+
+        TestGenInfo info{"", corpus.size, first, last, GetLengths(corpus.lengths, corpus.patterns, rng), first, last};
+        info.prefix_depth = corpus.depth;
+        info.from_text = 0.5;
+        info.seed = static_cast<unsigned>(rng()) | 1;
+
+        return GenerateTest(info);
+    }
+
+    std::vector<Engine> MakeEngines(const std::vector<std::string>& patterns) {
+
+        std::vector<Engine> engines;
+
+        // an engine that can't be built keeps its place with the error; machines without an OpenCL device
+        // still get the CPU numbers, and a record of what is missing
+        auto add = [&engines](const std::string& name, const std::function<Engine::Match()>& make) {
+            try {
+                engines.push_back({name, make(), ""});
+            } catch (const std::exception& e) {
+                engines.push_back({name, nullptr, e.what()});
+            }
+        };
+
+        auto cpu = [&patterns](PatternMatchingCPU::Engine engine, size_t threads) {
+            auto finder = std::make_shared<PatternMatchingCPU>(patterns, engine, threads);
+            return Engine::Match([finder](std::string_view text) { size_t time = 0; return finder->GetCounts(text, time); });
+        };
+
+        // std::string::find per pattern goes first, it is the reference the other engines are checked against
+        add("cpu-find", [&] { return cpu(PatternMatchingCPU::Engine::Find, 1); });
+        add("cpu", [&] { return cpu(PatternMatchingCPU::Engine::AhoCorasick, 1); });
+        add("cpu-parallel", [&] { return cpu(PatternMatchingCPU::Engine::AhoCorasick, 0); });
+
+        const std::pair<const char*, PatternMatchingGPU::Index> indexes[] = {
+            {"gpu", PatternMatchingGPU::Index::Table}, {"gpu-hash", PatternMatchingGPU::Index::Hash}};
+
+        for (const auto& [name, index] : indexes) {
+            add(name, [&patterns, index = index] {
+                PatternMatchingGPU::Options options;
+                options.index = index;
+                auto gpu = std::make_shared<PatternMatchingGPU>(patterns, options);
+                return Engine::Match([gpu](std::string_view text) { size_t time = 0; return gpu->Match(text, time); });
+            });
+        }
+
+        return engines;
+    }
+
+    // nearest rank of sorted times
+    double Percentile(const std::vector<double>& sorted, double p) {
+        const auto rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+
+    // a string as a JSON or CSV value, quoted and escaped
+    std::string Quote(const std::string& value, bool csv) {
+
+        std::string res = "\"";
+        for (const char c : value) {
+            if (c == '"')
+                res += csv ? "\"\"" : "\\\"";
+            else if (c == '\\' && !csv)
+                res += "\\\\";
+            else if (c == '\n')
+                res += csv ? " " : "\\n";
+            else
+                res += c;
+        }
+        return res + "\"";
+    }
+
+    class Report final {
+    public:
+        explicit Report(bool csv) : csv_(csv) {
+            if (csv_)
+                std::cout << "text_size,alphabet,patterns,lengths,prefix_depth,engine,repetitions,"
+                             "median_ms,p90_ms,p99_ms,gb_per_s,patterns_per_s,matches,ok,error" << std::endl;
+            else
+                std::cout << "[";
+        }
+
+        ~Report() {
+            if (!csv_)
+                std::cout << "\n]" << std::endl;
+        }
+
+        void Add(const Corpus& corpus, const std::string& engine, std::vector<double> seconds, size_t matches, bool ok) {
+
+            std::sort(seconds.begin(), seconds.end());
+            const double median = Percentile(seconds, 0.5);
+            const double p90 = Percentile(seconds, 0.9);
+            const double p99 = Percentile(seconds, 0.99);
+
+            // patterns/s: how many patterns are run over the whole text per second
+            const double gb_per_s = median > 0 ? corpus.size / median / 1e9 : 0;
+            const double patterns_per_s = median > 0 ? corpus.patterns / median : 0;
+
+            if (csv_) {
+                std::cout << corpus.size << ',' << corpus.alphabet << ',' << corpus.patterns << ',' << corpus.lengths << ','
+                          << corpus.depth << ',' << engine << ',' << seconds.size() << ',' << median * 1e3 << ','
+                          << p90 * 1e3 << ',' << p99 * 1e3 << ',' << gb_per_s << ',' << patterns_per_s << ','
+                          << matches << ',' << (ok ? "true" : "false") << ',' << std::endl;
+                return;
+            }
+
+            std::cout << (first_ ? "\n" : ",\n")
+                      << "  {\"text_size\": " << corpus.size << ", \"alphabet\": " << corpus.alphabet
+                      << ", \"patterns\": " << corpus.patterns << ", \"lengths\": \"" << corpus.lengths
+                      << "\", \"prefix_depth\": " << corpus.depth << ", \"engine\": \"" << engine
+                      << "\", \"repetitions\": " << seconds.size() << ", \"median_ms\": " << median * 1e3
+                      << ", \"p90_ms\": " << p90 * 1e3 << ", \"p99_ms\": " << p99 * 1e3
+                      << ", \"gb_per_s\": " << gb_per_s << ", \"patterns_per_s\": " << patterns_per_s
+                      << ", \"matches\": " << matches << ", \"ok\": " << (ok ? "true" : "false") << "}";
+            std::cout.flush();
+            first_ = false;
+        }
+
+        // an engine without numbers: not built for the corpus or failed on it
+        void AddError(const Corpus& corpus, const std::string& engine, const std::string& error) {
+
+            std::cerr << "Engine " << engine << " failed: " << error << std::endl;
+
+            if (csv_) {
+                std::cout << corpus.size << ',' << corpus.alphabet << ',' << corpus.patterns << ',' << corpus.lengths << ','
+                          << corpus.depth << ',' << engine << ",0,,,,,,,false," << Quote(error, true) << std::endl;
+                return;
+            }
+
+            std::cout << (first_ ? "\n" : ",\n")
+                      << "  {\"text_size\": " << corpus.size << ", \"alphabet\": " << corpus.alphabet
+                      << ", \"patterns\": " << corpus.patterns << ", \"lengths\": \"" << corpus.lengths
+                      << "\", \"prefix_depth\": " << corpus.depth << ", \"engine\": \"" << engine
+                      << "\", \"repetitions\": 0, \"ok\": false, \"error\": " << Quote(error, false) << "}";
+            std::cout.flush();
+            first_ = false;
+        }
+
+    private:
+        bool csv_;
+        bool first_ = true;
+    };
+
+    void Run(const Sweep& sweep) {
+
+        Report report(sweep.csv);
+
+        for (const auto size : sweep.sizes)
+        for (const auto alphabet : sweep.alphabets)
+        for (const auto patterns : sweep.patterns)
+        for (const auto& lengths : sweep.lengths)
+        for (const auto depth : sweep.depths) {
+            const Corpus corpus{size, alphabet, patterns, lengths, depth};
+            const auto test = Generate(corpus);
+
+            // without the reference's counts no engine can be checked, and every record is ok false
+            const auto engines = MakeEngines(test.patterns);
+            std::vector<size_t> reference;
+            bool has_reference = false;
+
+            for (const auto& engine : engines) {
+                if (!engine.match) {
+                    report.AddError(corpus, engine.name, engine.error);
+                    continue;
+                }
+
+                std::vector<double> seconds;
+                std::vector<size_t> res;
+                try {
+                    for (size_t i = 0; i < sweep.warmup; ++i)
+                        engine.match(test.text);
+
+                    for (size_t i = 0; i < sweep.repetitions; ++i) {
+                        const auto begin = std::chrono::steady_clock::now();
+                        res = engine.match(test.text);
+                        seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+                    }
+                } catch (const std::exception& e) {
+                    report.AddError(corpus, engine.name, e.what());
+                    continue;
+                }
+
+                if (&engine == &engines.front()) {
+                    reference = res;
+                    has_reference = true;
+                }
+
+                size_t matches = 0;
+                for (const auto count : res)
+                    matches += count;
+
+                report.Add(corpus, engine.name, std::move(seconds), matches, has_reference && res == reference);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+
+    try {
+        Run(ParseArgs(argc, argv));
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << "\nusage: " << argv[0] << " [--format json|csv] [--repetitions N] [--warmup N]"
+                  << " [--sizes N,...] [--alphabets N,...] [--patterns N,...] [--lengths short,mixed,long] [--depths N,...]"
+                  << std::endl;
+        return 1;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
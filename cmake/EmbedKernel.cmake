@@ -0,0 +1,15 @@
+# Turns an OpenCL source into a header with the source as a string constant, so it is compiled into the binary.
+# usage: cmake -DSOURCE=<kernel.cl> -DHEADER=<header.h> -DNAME=<constant name> -P EmbedKernel.cmake
+
+file(READ ${SOURCE} CONTENT)
+
+string(FIND "${CONTENT}" ")kernel_source\"" CLASH)
+if (NOT CLASH EQUAL -1)
+    message(FATAL_ERROR "${SOURCE} contains the raw string delimiter")
+endif ()
+
+file(WRITE ${HEADER}
+        "#pragma once\n\n"
+        "// generated from ${SOURCE}, don't edit\n\n"
+        "#include <string_view>\n\n"
+        "inline constexpr std::string_view ${NAME} = R\"kernel_source(${CONTENT})kernel_source\";\n")
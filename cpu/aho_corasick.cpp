@@ -0,0 +1,117 @@
+#include "aho_corasick.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+AhoCorasick::AhoCorasick(const std::vector<std::string>& patterns) {
+
+    for (const auto& pattern : patterns)
+        for (const auto c : pattern) {
+            auto& cls = classes_[static_cast<unsigned char>(c)];
+            if (!cls)
+                cls = alphabet_++;
+        }
+
+    BuildTrie(patterns);
+    BuildLinks();
+}
+
+void AhoCorasick::BuildTrie(const std::vector<std::string>& patterns) {
+
+    transitions_.assign(alphabet_, none_);
+    fail_.assign(1, root_);
+    terminals_.reserve(patterns.size());
+
+    for (const auto& pattern : patterns) {
+        if (pattern.empty()) {
+            terminals_.push_back(none_);
+            continue;
+        }
+
+        State state = root_;
+        for (const auto c : pattern) {
+            auto& next = transitions_[static_cast<size_t>(state) * alphabet_ + classes_[static_cast<unsigned char>(c)]];
+
+            if (next == none_) {
+                if (fail_.size() == none_)
+                    throw std::length_error("Too many states in Aho-Corasick automaton");
+
+                next = static_cast<State>(fail_.size());
+                fail_.push_back(root_);
+                transitions_.resize(transitions_.size() + alphabet_, none_);
+            }
+            // resize above may have moved the table, so don't reuse `next`
+            state = transitions_[static_cast<size_t>(state) * alphabet_ + classes_[static_cast<unsigned char>(c)]];
+        }
+        terminals_.push_back(state);
+    }
+}
+
+void AhoCorasick::BuildLinks() {
+
+    order_.reserve(fail_.size());
+    order_.push_back(root_);
+
+    for (size_t c = 0; c < alphabet_; ++c) {
+        auto& next = transitions_[c];
+        if (next == none_)
+            next = root_;
+        else
+            order_.push_back(next);
+    }
+
+    for (size_t n = 1; n < order_.size(); ++n) {
+        const State state = order_[n];
+        const size_t row = static_cast<size_t>(state) * alphabet_;
+        const size_t fail_row = static_cast<size_t>(fail_[state]) * alphabet_;
+
+        for (size_t c = 0; c < alphabet_; ++c) {
+            auto& next = transitions_[row + c];
+            if (next == none_) {
+                next = transitions_[fail_row + c];
+            } else {
+                fail_[next] = transitions_[fail_row + c];
+                order_.push_back(next);
+            }
+        }
+    }
+}
+
+std::vector<size_t> AhoCorasick::Count(std::string_view text) const {
+
+    // hits[s] - how many times the automaton stood in state s
+    std::vector<size_t> hits(fail_.size());
+    Scan(text, 0, hits);
+
+    return Collect(hits);
+}
+
+void AhoCorasick::Scan(std::string_view text, size_t skip, std::vector<size_t>& hits) const {
+
+    skip = std::min(skip, text.size());
+
+    // the skipped prefix only brings the automaton into the state it would have in the full text
+    State state = root_;
+    for (size_t i = 0; i < skip; ++i)
+        state = Next(state, static_cast<unsigned char>(text[i]));
+
+    for (size_t i = skip; i < text.size(); ++i) {
+        state = Next(state, static_cast<unsigned char>(text[i]));
+        ++hits[state];
+    }
+}
+
+std::vector<size_t> AhoCorasick::Collect(std::vector<size_t>& hits) const {
+
+    // pattern ending in state s also ends in every state whose failure chain reaches s,
+    // so sum the hits over subtrees of the failure tree (children come later in BFS order)
+    for (size_t n = order_.size() - 1; n > 0; --n)
+        hits[fail_[order_[n]]] += hits[order_[n]];
+
+    std::vector<size_t> res(terminals_.size());
+    for (size_t i = 0; i < terminals_.size(); ++i)
+        if (terminals_[i] != none_)
+            res[i] = hits[terminals_[i]];
+
+    return res;
+}
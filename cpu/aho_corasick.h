@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Aho-Corasick automaton over the whole pattern set.
+// Goto and failure links are folded into one flat (states x classes) table,
+// bytes that never occur in a pattern share a single column.
+class AhoCorasick final {
+public:
+    explicit AhoCorasick(const std::vector<std::string>& patterns);
+
+    // number of (possibly overlapping) occurrences of every pattern
+    std::vector<size_t> Count(std::string_view text) const;
+
+    // Chunked counting: Scan() adds state visits of the text to hits (GetStatesCount() long),
+    // ignoring matches that end within the first `skip` bytes. Hits of several scans
+    // can be summed before a single Collect() turns them into per-pattern counts.
+    void Scan(std::string_view text, size_t skip, std::vector<size_t>& hits) const;
+    std::vector<size_t> Collect(std::vector<size_t>& hits) const;
+
+    size_t GetStatesCount() const noexcept { return fail_.size(); }
+
+private:
+    using State = uint32_t;
+    static constexpr State root_ = 0;
+    static constexpr State none_ = UINT32_MAX;
+
+    State Next(State state, unsigned char c) const {
+        return transitions_[static_cast<size_t>(state) * alphabet_ + classes_[c]];
+    }
+
+    void BuildTrie(const std::vector<std::string>& patterns);
+    void BuildLinks();
+
+    std::array<uint16_t, 256> classes_{}; // byte -> column of the transition table
+    size_t alphabet_ = 1;
+
+    std::vector<State> transitions_;
+    std::vector<State> fail_;
+    std::vector<State> order_;     // states in BFS order
+    std::vector<State> terminals_; // pattern index -> state, none_ for empty patterns
+};
@@ -1,6 +1,23 @@
 #include "cpu_finder.h"
 
-size_t PatternMatchingCPU::find(const std::string& text, const std::string& pattern) const {
+#include <algorithm>
+
+PatternMatchingCPU::PatternMatchingCPU(const std::vector<std::string>& patterns, Engine engine, size_t threads)
+    : patterns_(patterns) {
+
+    for (const auto& pattern : patterns_)
+        max_length_ = std::max(max_length_, pattern.size());
+
+    if (engine == Engine::AhoCorasick)
+        automaton_.emplace(patterns_);
+
+    if (!threads)
+        threads = std::thread::hardware_concurrency();
+    if (threads > 1)
+        pool_ = std::make_unique<ThreadPool>(threads);
+}
+
+size_t PatternMatchingCPU::find(std::string_view text, const std::string& pattern) const {
 
     if ( (pattern.size() > text.size()) || (pattern.empty()) )
         return 0;
@@ -12,18 +29,64 @@ size_t PatternMatchingCPU::find(const std::string& text, const std::string& patt
     return ans;
 }
 
-std::vector<size_t> PatternMatchingCPU::GetCounts(const std::string& text, size_t& time) const {
+std::vector<size_t> PatternMatchingCPU::GetCounts(std::string_view text, size_t& time) const {
 
     auto start = std::chrono::system_clock::now();
 
     std::vector<size_t> res;
-    res.reserve(patterns_.size());
 
-    for(const auto& pattern : patterns_)
-        res.emplace_back(find(text, pattern));
+    if (pool_ && text.size() > min_chunk_size_) {
+        res = CountParallel(text);
+    } else if (automaton_) {
+        res = automaton_->Count(text);
+    } else {
+        res.reserve(patterns_.size());
+
+        for(const auto& pattern : patterns_)
+            res.emplace_back(find(text, pattern));
+    }
 
     auto finish = std::chrono::system_clock::now();
     time = (finish - start).count();
 
     return res;
-}
\ No newline at end of file
+}
+
+void PatternMatchingCPU::CountRange(std::string_view text, size_t begin, size_t end, std::vector<size_t>& acc) const {
+
+    // a match ending at or after `begin` starts at most (max_length_ - 1) bytes before it
+    if (automaton_) {
+        const size_t from = begin - std::min(begin, max_length_ ? max_length_ - 1 : 0);
+        automaton_->Scan(text.substr(from, end - from), begin - from, acc);
+        return;
+    }
+
+    for (size_t i = 0; i < patterns_.size(); ++i) {
+        const auto& pattern = patterns_[i];
+        const size_t from = begin - std::min(begin, pattern.empty() ? 0 : pattern.size() - 1);
+        acc[i] += find(text.substr(from, end - from), pattern);
+    }
+}
+
+std::vector<size_t> PatternMatchingCPU::CountParallel(std::string_view text) const {
+
+    const size_t workers = pool_->GetThreadsCount();
+
+    // a few chunks per worker, so that stealing can even out the load
+    const size_t chunk_size = std::max({min_chunk_size_, max_length_, text.size() / (workers * 4) + 1});
+    const size_t chunks = (text.size() + chunk_size - 1) / chunk_size;
+
+    const size_t acc_size = automaton_ ? automaton_->GetStatesCount() : patterns_.size();
+    std::vector<std::vector<size_t>> acc(workers, std::vector<size_t>(acc_size));
+
+    pool_->Run(chunks, [&](size_t chunk, size_t worker) {
+        const size_t begin = chunk * chunk_size;
+        CountRange(text, begin, std::min(begin + chunk_size, text.size()), acc[worker]);
+    });
+
+    for (size_t w = 1; w < workers; ++w)
+        for (size_t i = 0; i < acc_size; ++i)
+            acc[0][i] += acc[w][i];
+
+    return automaton_ ? automaton_->Collect(acc[0]) : acc[0];
+}
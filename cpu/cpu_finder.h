@@ -1,17 +1,39 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <chrono>
+#include <memory>
+#include <optional>
+
+#include "aho_corasick.h"
+#include "thread_pool.h"
 
 class PatternMatchingCPU final {
 public:
-    PatternMatchingCPU(const std::vector<std::string>& patterns) : patterns_(patterns) {}
+    enum class Engine {
+        Find,       // std::string::find per pattern, reference implementation
+        AhoCorasick // whole pattern set in one pass over the text
+    };
+
+    // threads > 1 splits the text into chunks scanned in parallel, 0 means one per hardware thread
+    PatternMatchingCPU(const std::vector<std::string>& patterns, Engine engine = Engine::Find, size_t threads = 1);
 
-    std::vector<size_t> GetCounts(const std::string& text, size_t& time) const;
+    std::vector<size_t> GetCounts(std::string_view text, size_t& time) const;
 private:
 
-    size_t find(const std::string& text, const std::string& pattern) const;
+    size_t find(std::string_view text, const std::string& pattern) const;
+
+    // adds matches ending in text[begin, end) to acc: per-pattern counts for Find, state hits for AhoCorasick
+    void CountRange(std::string_view text, size_t begin, size_t end, std::vector<size_t>& acc) const;
+    std::vector<size_t> CountParallel(std::string_view text) const;
+
+    static constexpr size_t min_chunk_size_ = 1 << 16;
 
     std::vector<std::string> patterns_;
-};
\ No newline at end of file
+    size_t max_length_ = 0;
+
+    std::optional<AhoCorasick> automaton_;
+    std::unique_ptr<ThreadPool> pool_;
+};
@@ -0,0 +1,241 @@
+#include "packed_matcher.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PACKED_MATCHER_X86 1
+#include <immintrin.h>
+#else
+#define PACKED_MATCHER_X86 0
+#endif
+
+namespace {
+
+    enum class Isa { Scalar, SSE, AVX2 };
+
+    Isa DetectIsa() {
+#if PACKED_MATCHER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return Isa::AVX2;
+        if (__builtin_cpu_supports("sse4.2"))
+            return Isa::SSE;
+#endif
+        return Isa::Scalar;
+    }
+
+    const Isa isa = DetectIsa();
+}
+
+PackedMatcher::PackedMatcher(const std::vector<std::string>& patterns, size_t max_size) {
+
+    std::vector<size_t> multi;
+    size_t shortest = max_size;
+
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        const auto& pat = patterns[i];
+        if (pat.empty() || pat.size() > max_size)
+            continue;
+
+        if (pat.size() == 1) {
+            singles_[static_cast<unsigned char>(pat[0])].push_back(i);
+            has_singles_ = true;
+        } else {
+            multi.push_back(i);
+            shortest = std::min(shortest, pat.size());
+        }
+    }
+
+    if (multi.empty())
+        return;
+
+    width_ = std::min(max_width_, shortest);
+
+    // patterns with the same masked prefix go to one bucket, so they don't widen other buckets' masks
+    std::map<std::string, std::vector<size_t>> groups;
+    for (const auto i : multi)
+        groups[patterns[i].substr(0, width_)].push_back(i);
+
+    std::vector<const std::vector<size_t>*> order;
+    for (const auto& [prefix, ids] : groups)
+        order.push_back(&ids);
+    std::stable_sort(order.begin(), order.end(), [](auto l, auto r) { return l->size() > r->size(); });
+
+    for (const auto* ids : order) {
+        const auto bucket = std::min_element(buckets_.begin(), buckets_.end(),
+                                             [](const auto& l, const auto& r) { return l.size() < r.size(); });
+        const auto bit = static_cast<uint8_t>(1u << (bucket - buckets_.begin()));
+
+        for (const auto i : *ids) {
+            const auto& pat = patterns[i];
+            for (size_t k = 0; k < width_; ++k) {
+                const auto c = static_cast<unsigned char>(pat[k]);
+                lo_[k][c & 0xF] |= bit;
+                hi_[k][c >> 4] |= bit;
+            }
+            bucket->push_back({i, pat});
+        }
+    }
+}
+
+void PackedMatcher::Count(std::string_view text, size_t limit, std::vector<size_t>& res) const {
+
+    limit = std::min(limit, text.size());
+
+    if (has_singles_) {
+        std::array<size_t, 256> histogram{};
+        for (const auto c : text.substr(0, limit))
+            ++histogram[static_cast<unsigned char>(c)];
+
+        for (size_t c = 0; c < 256; ++c)
+            for (const auto id : singles_[c])
+                res[id] += histogram[c];
+    }
+
+    Scan(text, limit, {&res, nullptr});
+}
+
+void PackedMatcher::Find(std::string_view text, size_t limit, std::vector<std::pair<size_t, size_t>>& res) const {
+
+    limit = std::min(limit, text.size());
+
+    if (has_singles_)
+        for (size_t pos = 0; pos < limit; ++pos)
+            for (const auto id : singles_[static_cast<unsigned char>(text[pos])])
+                res.emplace_back(id, pos);
+
+    Scan(text, limit, {nullptr, &res});
+}
+
+void PackedMatcher::Scan(std::string_view text, size_t limit, const Sink& sink) const {
+
+    if (!width_)
+        return;
+
+    size_t pos = 0;
+    if (isa == Isa::AVX2)
+        pos = ScanAVX2(text, limit, sink);
+    else if (isa == Isa::SSE)
+        pos = ScanSSE(text, limit, sink);
+
+    ScanScalar(text, pos, limit, sink);
+}
+
+void PackedMatcher::Verify(std::string_view text, size_t pos, uint8_t buckets, const Sink& sink) const {
+
+    for (; buckets; buckets &= buckets - 1) {
+        for (const auto& entry : buckets_[__builtin_ctz(buckets)]) {
+            const auto& pat = entry.pattern;
+            if (pos + pat.size() <= text.size() && !std::memcmp(text.data() + pos, pat.data(), pat.size()))
+                sink.Add(entry.id, pos);
+        }
+    }
+}
+
+size_t PackedMatcher::ScanScalar(std::string_view text, size_t pos, size_t limit, const Sink& sink) const {
+
+    const auto* data = reinterpret_cast<const unsigned char*>(text.data());
+
+    for (; pos < limit && pos + width_ <= text.size(); ++pos) {
+        uint8_t buckets = 0xFF;
+        for (size_t k = 0; k < width_; ++k) {
+            const auto c = data[pos + k];
+            buckets &= lo_[k][c & 0xF] & hi_[k][c >> 4];
+        }
+
+        if (buckets)
+            Verify(text, pos, buckets, sink);
+    }
+
+    return pos;
+}
+
+#if PACKED_MATCHER_X86
+
+__attribute__((target("sse4.2")))
+size_t PackedMatcher::ScanSSE(std::string_view text, size_t limit, const Sink& sink) const {
+
+    const auto* data = reinterpret_cast<const unsigned char*>(text.data());
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i lo[max_width_], hi[max_width_];
+    for (size_t k = 0; k < width_; ++k) {
+        lo[k] = _mm_load_si128(reinterpret_cast<const __m128i*>(lo_[k].data()));
+        hi[k] = _mm_load_si128(reinterpret_cast<const __m128i*>(hi_[k].data()));
+    }
+
+    alignas(16) uint8_t candidates[16];
+
+    size_t pos = 0;
+    for (; pos + 16 <= limit && pos + 16 + width_ - 1 <= text.size(); pos += 16) {
+        __m128i acc = _mm_set1_epi8(-1);
+        for (size_t k = 0; k < width_; ++k) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + k));
+            const __m128i l = _mm_and_si128(v, nibble);
+            const __m128i h = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+            acc = _mm_and_si128(acc, _mm_and_si128(_mm_shuffle_epi8(lo[k], l), _mm_shuffle_epi8(hi[k], h)));
+        }
+
+        auto mask = static_cast<uint32_t>(~_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) & 0xFFFF);
+        if (!mask)
+            continue;
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(candidates), acc);
+        for (; mask; mask &= mask - 1) {
+            const auto i = __builtin_ctz(mask);
+            Verify(text, pos + i, candidates[i], sink);
+        }
+    }
+
+    return pos;
+}
+
+__attribute__((target("avx2")))
+size_t PackedMatcher::ScanAVX2(std::string_view text, size_t limit, const Sink& sink) const {
+
+    const auto* data = reinterpret_cast<const unsigned char*>(text.data());
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    // the same 16-byte table in both lanes, since vpshufb shuffles within a lane
+    __m256i lo[max_width_], hi[max_width_];
+    for (size_t k = 0; k < width_; ++k) {
+        lo[k] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(lo_[k].data())));
+        hi[k] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(hi_[k].data())));
+    }
+
+    alignas(32) uint8_t candidates[32];
+
+    size_t pos = 0;
+    for (; pos + 32 <= limit && pos + 32 + width_ - 1 <= text.size(); pos += 32) {
+        __m256i acc = _mm256_set1_epi8(-1);
+        for (size_t k = 0; k < width_; ++k) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos + k));
+            const __m256i l = _mm256_and_si256(v, nibble);
+            const __m256i h = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+            acc = _mm256_and_si256(acc, _mm256_and_si256(_mm256_shuffle_epi8(lo[k], l), _mm256_shuffle_epi8(hi[k], h)));
+        }
+
+        auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(acc, zero)));
+        if (!mask)
+            continue;
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(candidates), acc);
+        for (; mask; mask &= mask - 1) {
+            const auto i = __builtin_ctz(mask);
+            Verify(text, pos + i, candidates[i], sink);
+        }
+    }
+
+    return pos;
+}
+
+#else
+
+size_t PackedMatcher::ScanSSE(std::string_view, size_t, const Sink&) const { return 0; }
+size_t PackedMatcher::ScanAVX2(std::string_view, size_t, const Sink&) const { return 0; }
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Vectorized multi-pattern matcher for short patterns.
+// Multi-byte patterns are spread over 8 buckets; for the first bytes of every bucket
+// low and high nibble masks are kept, so one pshufb per nibble filters 16 (SSE) or
+// 32 (AVX2) text positions at once. Candidates are confirmed by exact comparison.
+// One-byte patterns are counted from a byte histogram.
+class PackedMatcher final {
+public:
+    // handles patterns with 0 < size <= max_size, other patterns are ignored
+    PackedMatcher(const std::vector<std::string>& patterns, size_t max_size);
+
+    // adds occurrences of the handled patterns to res[pattern index]
+    void Count(std::string_view text, std::vector<size_t>& res) const { Count(text, text.size(), res); }
+    // the same, but only for occurrences starting before `limit`
+    void Count(std::string_view text, size_t limit, std::vector<size_t>& res) const;
+    // appends (pattern index, position) of every occurrence starting before `limit`, in no particular order
+    void Find(std::string_view text, size_t limit, std::vector<std::pair<size_t, size_t>>& res) const;
+
+    bool empty() const noexcept { return !width_ && !has_singles_; }
+
+private:
+    static constexpr size_t buckets_count_ = 8;
+    static constexpr size_t max_width_ = 3;
+
+    struct Entry {
+        size_t id;
+        std::string pattern;
+    };
+
+    // where the scans put occurrences: counters, or positions when they are given
+    struct Sink {
+        std::vector<size_t>* counts = nullptr;
+        std::vector<std::pair<size_t, size_t>>* positions = nullptr;
+
+        void Add(size_t id, size_t pos) const {
+            if (positions)
+                positions->emplace_back(id, pos);
+            else
+                ++(*counts)[id];
+        }
+    };
+
+    void Scan(std::string_view text, size_t limit, const Sink& sink) const;
+    void Verify(std::string_view text, size_t pos, uint8_t buckets, const Sink& sink) const;
+    size_t ScanScalar(std::string_view text, size_t pos, size_t limit, const Sink& sink) const;
+    size_t ScanSSE(std::string_view text, size_t limit, const Sink& sink) const;
+    size_t ScanAVX2(std::string_view text, size_t limit, const Sink& sink) const;
+
+    std::array<std::vector<size_t>, 256> singles_; // byte -> one-byte patterns
+    bool has_singles_ = false;
+
+    std::array<std::vector<Entry>, buckets_count_> buckets_;
+    size_t width_ = 0; // bytes covered by the masks: min(max_width_, shortest multi-byte pattern)
+
+    alignas(32) std::array<std::array<uint8_t, 16>, max_width_> lo_{};
+    alignas(32) std::array<std::array<uint8_t, 16>, max_width_> hi_{};
+};
@@ -0,0 +1,116 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t threads) : queues_(std::max<size_t>(threads, 1)) {
+
+    threads_.reserve(queues_.size() - 1);
+    for (size_t i = 1; i < queues_.size(); ++i)
+        threads_.emplace_back([this, i] { Loop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+
+    for (auto& thread : threads_)
+        thread.join();
+}
+
+void ThreadPool::Run(size_t count, const Task& task) {
+
+    if (!count)
+        return;
+
+    std::lock_guard run_lock(run_mutex_);
+
+    // job must be visible before any of its tasks can be popped
+    job_ = &task;
+    error_ = nullptr;
+    remaining_ = count;
+
+    // contiguous blocks keep neighbouring tasks on one worker until someone steals them
+    const size_t workers = queues_.size();
+    for (size_t w = 0; w < workers; ++w) {
+        std::lock_guard lock(queues_[w].mutex);
+        for (size_t i = count * w / workers; i < count * (w + 1) / workers; ++i)
+            queues_[w].tasks.push_back(i);
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    Work(0);
+
+    std::unique_lock lock(mutex_);
+    done_.wait(lock, [this] { return remaining_ == 0; });
+    job_ = nullptr;
+
+    if (error_)
+        std::rethrow_exception(error_);
+}
+
+void ThreadPool::Loop(size_t worker) {
+
+    size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock lock(mutex_);
+            wake_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+            if (stop_)
+                return;
+            seen = generation_;
+        }
+        Work(worker);
+    }
+}
+
+void ThreadPool::Work(size_t worker) {
+
+    size_t task = 0;
+    while (Pop(worker, task) || Steal(worker, task)) {
+        try {
+            (*job_)(task, worker);
+        } catch (...) {
+            std::lock_guard lock(mutex_);
+            if (!error_)
+                error_ = std::current_exception();
+        }
+
+        if (--remaining_ == 0) {
+            std::lock_guard lock(mutex_);
+            done_.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::Pop(size_t worker, size_t& task) {
+
+    auto& queue = queues_[worker];
+    std::lock_guard lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::Steal(size_t worker, size_t& task) {
+
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        auto& queue = queues_[(worker + i) % queues_.size()];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
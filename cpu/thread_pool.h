@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool with per-worker task queues and work stealing.
+// The thread calling Run() takes part in the work as worker 0.
+class ThreadPool final {
+public:
+    using Task = std::function<void(size_t task, size_t worker)>;
+
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // number of workers, including the calling thread; worker indices are below this
+    size_t GetThreadsCount() const noexcept { return queues_.size(); }
+
+    // calls task(i, worker) for every i in [0, count) and waits for all of them
+    void Run(size_t count, const Task& task);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    void Loop(size_t worker);
+    void Work(size_t worker);
+    bool Pop(size_t worker, size_t& task);
+    bool Steal(size_t worker, size_t& task);
+
+    std::vector<Queue> queues_;
+    std::vector<std::thread> threads_;
+
+    std::mutex run_mutex_; // one Run() at a time
+
+    std::mutex mutex_;
+    std::condition_variable wake_, done_;
+    size_t generation_ = 0;
+    bool stop_ = false;
+
+    const Task* job_ = nullptr;
+    std::atomic<size_t> remaining_ = 0;
+    std::exception_ptr error_;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace linal {
+
+    // Allocation policies of Buf and Matrix. A policy is copied into every buffer and has
+    //   void* Allocate(size_t bytes, size_t alignment);             storage for bytes, aligned at least to alignment
+    //   void Deallocate(void* ptr, size_t bytes, size_t alignment); frees what Allocate returned for the same arguments
+    // Copies of a policy must free each other's storage, since moved buffers take their policy along.
+
+    // ::operator new[], enough for any T but with no alignment beyond alignof(max_align_t)
+    struct NewAllocator {
+        void* Allocate(size_t bytes, size_t) { return ::operator new[](bytes); }
+        void Deallocate(void* ptr, size_t, size_t) noexcept { ::operator delete[](ptr); }
+    };
+
+    // aligned to a cache line by default, so rows can be loaded with the widest SIMD loads
+    template <size_t Alignment = 64>
+    struct AlignedAllocator {
+        static_assert(Alignment && !(Alignment & (Alignment - 1)), "Alignment must be a power of 2");
+
+        void* Allocate(size_t bytes, size_t alignment) {
+            return ::operator new[](bytes, std::align_val_t(std::max(Alignment, alignment)));
+        }
+        void Deallocate(void* ptr, size_t, size_t alignment) noexcept {
+            ::operator delete[](ptr, std::align_val_t(std::max(Alignment, alignment)));
+        }
+    };
+
+    // whole pages mapped for every buffer: page-aligned, so the memory can be wrapped by the device
+    // with CL_MEM_USE_HOST_PTR; huge asks for transparent huge pages where the system has them
+    class PageAllocator {
+    public:
+        explicit PageAllocator(bool huge = false) : huge_(huge) {}
+
+        void* Allocate(size_t bytes, size_t) {
+            void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED)
+                throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+            if (huge_)
+                madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+            return ptr;
+        }
+        void Deallocate(void* ptr, size_t bytes, size_t) noexcept { munmap(ptr, bytes); }
+
+    private:
+        bool huge_;
+    };
+
+    // Bump allocation from big blocks, all freed at once with the arena: for many buffers built together,
+    // e.g. the tables of one pattern set, that would otherwise go to malloc one by one.
+    class Arena final {
+    public:
+        explicit Arena(size_t block_size = 1 << 20) : block_size_(block_size) {}
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void* Allocate(size_t bytes, size_t alignment) {
+
+            alignment = std::max(alignment, block_alignment_);
+
+            // the address is aligned, not the offset: a block is only aligned as its first buffer asked
+            size_t at = 0;
+            if (!blocks_.empty()) {
+                const auto base = reinterpret_cast<uintptr_t>(blocks_.back().data.get());
+                at = (base + used_ + alignment - 1) / alignment * alignment - base;
+            }
+
+            // a buffer bigger than a block gets a block of its own
+            if (blocks_.empty() || at + bytes > blocks_.back().size) {
+                const size_t size = std::max(bytes, block_size_);
+                auto* data = static_cast<std::byte*>(::operator new[](size, std::align_val_t(alignment)));
+                blocks_.push_back({Block::Storage(data, Block::Free{alignment}), size});
+                at = 0;
+            }
+
+            used_ = at + bytes;
+            return blocks_.back().data.get() + at;
+        }
+
+        size_t GetBlocksCount() const noexcept { return blocks_.size(); }
+
+    private:
+        struct Block {
+            struct Free {
+                size_t alignment = 0;
+                void operator()(std::byte* ptr) const noexcept { ::operator delete[](ptr, std::align_val_t(alignment)); }
+            };
+            using Storage = std::unique_ptr<std::byte[], Free>;
+
+            Storage data;
+            size_t size;
+        };
+
+        static constexpr size_t block_alignment_ = 64;
+
+        size_t block_size_;
+        size_t used_ = 0; // bytes taken from the last block
+        std::vector<Block> blocks_;
+    };
+
+    // takes storage from an arena that outlives the buffers, freeing is left to the arena
+    class ArenaAllocator {
+    public:
+        explicit ArenaAllocator(Arena& arena) : arena_(&arena) {}
+
+        void* Allocate(size_t bytes, size_t alignment) { return arena_->Allocate(bytes, alignment); }
+        void Deallocate(void*, size_t, size_t) noexcept {}
+
+    private:
+        Arena* arena_;
+    };
+
+}
@@ -1,20 +1,23 @@
 #pragma once
 #include <iostream>
 
+#include "Allocators.h"
+
 namespace linal {
 
-    template<typename T>
+    // storage of size_ elements, the first used_ of them constructed; Alloc is one of the policies of Allocators.h
+    template<typename T, typename Alloc = NewAllocator>
     class Buf {
 
     protected:
 
-        Buf(size_t size) {
+        explicit Buf(size_t size, const Alloc& alloc = Alloc()) : alloc_(alloc) {
 
             if (size < 0)
                 throw std::invalid_argument("Bad size (size < 0)");
 
             if (size)
-                data_ = static_cast<T *> (::operator new[](sizeof_ * size));
+                data_ = static_cast<T *> (alloc_.Allocate(sizeof_ * size, alignof(T)));
             else
                 data_ = nullptr;
 
@@ -22,19 +25,21 @@ namespace linal {
             used_ = 0;
         }
 
-        Buf(Buf &&buf) noexcept: Buf(0) {
+        Buf(Buf &&buf) noexcept: Buf(0, buf.alloc_) {
             swap(buf);
         }
 
         Buf &operator=(Buf &&buf) noexcept {
-            swap(std::move(buf));
+            swap(buf);
+            return *this;
         }
 
         ~Buf() {
             for (int i = 0; i < used_; ++i)
                 (data_ + i)->~T();
 
-            operator delete[](data_);
+            if (data_)
+                alloc_.Deallocate(data_, sizeof_ * size_, alignof(T));
         }
 
         const T* buf() const {return data_;}
@@ -44,8 +49,11 @@ namespace linal {
             std::swap(size_, buf.size_);
             std::swap(used_, buf.used_);
             std::swap(sizeof_, buf.sizeof_);
+            std::swap(alloc_, buf.alloc_);
         }
 
+        Alloc alloc_; // goes along with the storage, so a moved buffer is freed by the policy that allocated it
+
         T *data_ = nullptr;
         size_t size_ = 0, used_ = 0;
         size_t sizeof_ = sizeof(T);
@@ -59,6 +67,8 @@ namespace linal {
         Buf(const Buf& buf) = delete;
         Buf& operator=(const Buf& buf) = delete;;
 
+        const Alloc& GetAllocator() const noexcept {return alloc_;}
+
     };
 
-}
\ No newline at end of file
+}
@@ -17,19 +17,23 @@ namespace linal {
     constexpr double tests_eps = 0.01; // acceptable eps
 
 
-    template<typename T = double>
-class Matrix final : private Buf<T> {
+    // storage comes from Alloc, one of the allocation policies of Allocators.h;
+    // matrices made from a matrix (copies, resizes, minors, products) use a copy of its allocator
+    template<typename T = double, typename Alloc = NewAllocator>
+class Matrix final : private Buf<T, Alloc> {
 
-    using Buf<T>::data_;
-    using Buf<T>::used_;
-    using Buf<T>::size_;
-    using Buf<T>::buf;
+    using Buf<T, Alloc>::data_;
+    using Buf<T, Alloc>::used_;
+    using Buf<T, Alloc>::size_;
+    using Buf<T, Alloc>::buf;
+    using Buf<T, Alloc>::alloc_;
 
     public:
 
 
         Matrix();
-        Matrix(size_t rows, size_t columns, T value = T{});
+        explicit Matrix(const Alloc& alloc);
+        Matrix(size_t rows, size_t columns, T value = T{}, const Alloc& alloc = Alloc());
         Matrix(size_t rows, size_t columns, const std::initializer_list<T> &elems);
         Matrix(const std::initializer_list<std::initializer_list<T>> &elems);
 
@@ -47,8 +51,8 @@ class Matrix final : private Buf<T> {
         void resize(size_t rows, size_t columns);
         void clear();
 
-        template <typename U> void Copy(const Matrix<U>& m);
-        template <typename U> explicit Matrix(const Matrix<U> &m);
+        template <typename U, typename A> void Copy(const Matrix<U, A>& m);
+        template <typename U, typename A> explicit Matrix(const Matrix<U, A> &m);
         Matrix(const Matrix& m) ;
         Matrix& operator=(const Matrix& m);
 
@@ -63,10 +67,10 @@ class Matrix final : private Buf<T> {
 
         Matrix& multiply(const Matrix& m)&;
 
-        template <typename U>
-        bool operator == (const Matrix<U>& m) const;
-        template <typename U>
-        bool operator != (const Matrix<U>& m) const;
+        template <typename U, typename A>
+        bool operator == (const Matrix<U, A>& m) const;
+        template <typename U, typename A>
+        bool operator != (const Matrix<U, A>& m) const;
 
         void SwapRows(size_t r1, size_t r2);
         void SwapColumns(size_t c1, size_t c2);
@@ -81,6 +85,7 @@ class Matrix final : private Buf<T> {
         Matrix& transpose()&;
 
         const T* data() const {return buf();};
+        using Buf<T, Alloc>::GetAllocator;
 
         ~Matrix() = default;
 
@@ -93,8 +98,8 @@ class Matrix final : private Buf<T> {
     void RandomFill(Matrix<int> &m, int d1, int d2);
     void RandomFill(Matrix<double> &m, int d1, int d2);
 
-    template<typename T>
-    std::istream& operator>>(std::istream& str, Matrix<T>& m) {
+    template<typename T, typename Alloc>
+    std::istream& operator>>(std::istream& str, Matrix<T, Alloc>& m) {
 
         int r;
         str>>r;
@@ -113,12 +118,15 @@ class Matrix final : private Buf<T> {
 
     //................Constructor..........................
 
-    template<typename T>
-    Matrix<T>::Matrix(): Buf<T>(0) {};
+    template<typename T, typename Alloc>
+    Matrix<T, Alloc>::Matrix(): Buf<T, Alloc>(0) {};
 
-    template<typename T>
-    Matrix<T>::Matrix(size_t rows, size_t columns, T value) :
-            Buf<T>(rows * columns), rows_(rows), columns_(columns) {
+    template<typename T, typename Alloc>
+    Matrix<T, Alloc>::Matrix(const Alloc& alloc): Buf<T, Alloc>(0, alloc) {};
+
+    template<typename T, typename Alloc>
+    Matrix<T, Alloc>::Matrix(size_t rows, size_t columns, T value, const Alloc& alloc) :
+            Buf<T, Alloc>(rows * columns, alloc), rows_(rows), columns_(columns) {
 
         if(rows_ < 0 || columns_ < 0)
             throw std::invalid_argument("the dimensions of the matrix must be positive");
@@ -128,9 +136,9 @@ class Matrix final : private Buf<T> {
 
     }
 
-    template<typename T>
-    Matrix<T>::Matrix(size_t rows, size_t columns, const std::initializer_list<T> &elems) :
-            Buf<T>(rows*columns), rows_(rows), columns_(columns) {
+    template<typename T, typename Alloc>
+    Matrix<T, Alloc>::Matrix(size_t rows, size_t columns, const std::initializer_list<T> &elems) :
+            Buf<T, Alloc>(rows*columns), rows_(rows), columns_(columns) {
 
         if(rows_ < 0 || columns_ < 0)
             throw std::invalid_argument("the dimensions of the matrix must be positive");
@@ -153,9 +161,9 @@ class Matrix final : private Buf<T> {
 
     }
 
-    template<typename T>
-    Matrix<T>::Matrix(const std::initializer_list<std::initializer_list<T>> &elems) :
-           Buf<T>(0) ,rows_(elems.size()) {
+    template<typename T, typename Alloc>
+    Matrix<T, Alloc>::Matrix(const std::initializer_list<std::initializer_list<T>> &elems) :
+           Buf<T, Alloc>(0) ,rows_(elems.size()) {
 
         size_t columns = 0;
 
@@ -164,8 +172,8 @@ class Matrix final : private Buf<T> {
 
         columns_ = columns;
 
-        Matrix<T> tmp(rows_, columns_);
-        Buf<T>::swap(tmp);
+        Matrix<T, Alloc> tmp(rows_, columns_);
+        Buf<T, Alloc>::swap(tmp);
 
         int i = 0;
         for (const auto& str : elems) {
@@ -185,15 +193,15 @@ class Matrix final : private Buf<T> {
 
     //................Constructor_end......................
 
-    template <typename T>
-    T& Matrix<T>::at(size_t i, size_t j)&
+    template <typename T, typename Alloc>
+    T& Matrix<T, Alloc>::at(size_t i, size_t j)&
     {
-        return const_cast<T&>(static_cast<const Matrix<T>*>(this)->at(i, j));
+        return const_cast<T&>(static_cast<const Matrix<T, Alloc>*>(this)->at(i, j));
     }
 
 
-    template <typename T>
-    const T& Matrix<T>::at(size_t i, size_t j) const&
+    template <typename T, typename Alloc>
+    const T& Matrix<T, Alloc>::at(size_t i, size_t j) const&
     {
         if (i >= rows_ || j >= columns_)
             throw std::out_of_range("Out of range");
@@ -204,14 +212,14 @@ class Matrix final : private Buf<T> {
 
     //................Copy.................................
 
-    template <typename T>
-    template <typename U>
-    void Matrix<T>::Copy(const Matrix<U>& m)
+    template <typename T, typename Alloc>
+    template <typename U, typename A>
+    void Matrix<T, Alloc>::Copy(const Matrix<U, A>& m)
     {
         const size_t min_row = std::min(rows_, m.GetRows());
         const size_t min_col = std::min(columns_, m.GetColumns());
 
-        Matrix<T> tmp(rows_, columns_);
+        Matrix<T, Alloc> tmp(rows_, columns_, T{}, alloc_);
 
 
         for (size_t i = 0; i < min_row; i++)
@@ -227,26 +235,26 @@ class Matrix final : private Buf<T> {
                 new (&tmp.at(i, k)) T ();
         }
 
-        Buf<T>::swap(tmp);
+        Buf<T, Alloc>::swap(tmp);
     }
 
-    template <typename T>
-    template <typename U>
-    Matrix<T>::Matrix(const Matrix<U> &m)
+    template <typename T, typename Alloc>
+    template <typename U, typename A>
+    Matrix<T, Alloc>::Matrix(const Matrix<U, A> &m)
             : Matrix(m.GetRows(), m.GetColumns()) {
 
         Copy(m);
     }
 
-    template <typename T>
-    Matrix<T>::Matrix(const Matrix& m)
-            : Matrix(m.rows_, m.columns_)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc>::Matrix(const Matrix& m)
+            : Matrix(m.rows_, m.columns_, T{}, m.alloc_)
     {
         Copy(m);
     }
 
-    template <typename T>
-    Matrix<T>& Matrix<T>::operator = (const Matrix& m)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc>& Matrix<T, Alloc>::operator = (const Matrix& m)
     {
         if (this == &m)
             return *this;
@@ -260,29 +268,29 @@ class Matrix final : private Buf<T> {
 
     //..................Copy_end........................
 
-    template <typename T>
-    Matrix<T>::Matrix(Matrix&& m)
-            : Matrix()
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc>::Matrix(Matrix&& m)
+            : Matrix(m.alloc_)
     {
         rows_ = m.rows_;
         columns_ = m.columns_;
-        Buf<T>::swap(m);
+        Buf<T, Alloc>::swap(m);
     }
 
-    template <typename T>
-    Matrix<T>& Matrix<T>::operator= (Matrix&& m)  {
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc>& Matrix<T, Alloc>::operator= (Matrix&& m)  {
 
         if (this == &m)
             return *this;
 
         rows_ = m.rows_;
         columns_ = m.columns_;
-        Buf<T>::swap(m);
+        Buf<T, Alloc>::swap(m);
         return *this;
     }
 
-    template <typename T>
-    void Matrix<T>::resize(size_t rows, size_t columns) {
+    template <typename T, typename Alloc>
+    void Matrix<T, Alloc>::resize(size_t rows, size_t columns) {
         if (rows < 0 || columns < 0)
             throw std::invalid_argument("the dimensions of the matrix must be positive");
 
@@ -292,7 +300,7 @@ class Matrix final : private Buf<T> {
         }
 
         if (!data_) {
-            *this = std::move(Matrix<T>(rows, columns));
+            *this = std::move(Matrix<T, Alloc>(rows, columns, T{}, alloc_));
             return;
         }
 
@@ -321,7 +329,7 @@ class Matrix final : private Buf<T> {
             columns_ = columns;
         }
         else {
-            Matrix<T> tmp(rows, columns);
+            Matrix<T, Alloc> tmp(rows, columns, T{}, alloc_);
             tmp.Copy(*this);
             *this = std::move(tmp);
         }
@@ -332,8 +340,8 @@ class Matrix final : private Buf<T> {
     // (+=, -=, *=, =, -, *).............................
 
 
-    template <typename T>
-    Matrix<T>& Matrix<T>::operator += (const Matrix& m)& {
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc>& Matrix<T, Alloc>::operator += (const Matrix& m)& {
 
         if (rows_ != m.rows_ || columns_ != m.columns_)
             throw std::invalid_argument("the dimensions of the matrices must be the same");
@@ -347,8 +355,8 @@ class Matrix final : private Buf<T> {
         return *this;
     }
 
-    template <typename T>
-    Matrix<T>& Matrix<T>::operator -= (const Matrix<T>& m)& {
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc>& Matrix<T, Alloc>::operator -= (const Matrix<T, Alloc>& m)& {
 
         if (rows_ != m.rows_ || columns_ != m.columns_)
             throw std::invalid_argument("the dimensions of the matrices must be the same");
@@ -362,8 +370,8 @@ class Matrix final : private Buf<T> {
     }
 
 
-    template <typename T>
-    Matrix<T>& Matrix<T>::operator *= (const T& number)& {
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc>& Matrix<T, Alloc>::operator *= (const T& number)& {
 
         for (size_t i = 0; i < rows_; i++)
         {
@@ -373,106 +381,106 @@ class Matrix final : private Buf<T> {
     }
 
 
-    template <typename T>
-    Matrix<T> operator + (const Matrix<T>& l, const Matrix<T>& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator + (const Matrix<T, Alloc>& l, const Matrix<T, Alloc>& r)
     {
-        Matrix<T> res(l);
+        Matrix<T, Alloc> res(l);
         res += r;
         return res;
     }
 
-    template <typename T>
-    Matrix<T> operator + (const Matrix<T>& l, Matrix<T>&& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator + (const Matrix<T, Alloc>& l, Matrix<T, Alloc>&& r)
     {
-        Matrix<T> res(std::move(r));
+        Matrix<T, Alloc> res(std::move(r));
         r += l;
         return res;
     }
-    template <typename T>
-    Matrix<T> operator + (Matrix<T>&& l, const Matrix<T>& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator + (Matrix<T, Alloc>&& l, const Matrix<T, Alloc>& r)
     {
-        Matrix<T> res(std::move(l));
+        Matrix<T, Alloc> res(std::move(l));
         res += r;
         return res;
     }
-    template <typename T>
-    Matrix<T> operator + (Matrix<T>&& l, Matrix<T>&& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator + (Matrix<T, Alloc>&& l, Matrix<T, Alloc>&& r)
     {
-        Matrix<T> res(std::move(l));
+        Matrix<T, Alloc> res(std::move(l));
         res += r;
         return res;
     }
 
 
 
-    template <typename T>
-    Matrix<T> operator - (const Matrix<T>& l, const Matrix<T>& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator - (const Matrix<T, Alloc>& l, const Matrix<T, Alloc>& r)
     {
-        Matrix<T> res(l);
+        Matrix<T, Alloc> res(l);
         res -= r;
         return res;
     }
-    template <typename T>
-    Matrix<T> operator - (const Matrix<T>& l, Matrix<T>&& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator - (const Matrix<T, Alloc>& l, Matrix<T, Alloc>&& r)
     {
-        Matrix<T> res(std::move(r));
+        Matrix<T, Alloc> res(std::move(r));
         res -= l;
         return res;
     }
-    template <typename T>
-    Matrix<T> operator - (Matrix<T>&& l, const Matrix<T>& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator - (Matrix<T, Alloc>&& l, const Matrix<T, Alloc>& r)
     {
-        Matrix<T> res(std::move(l));
+        Matrix<T, Alloc> res(std::move(l));
         res -= r;
         return res;
     }
-    template <typename T>
-    Matrix<T> operator - (Matrix<T>&& l, Matrix<T>&& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator - (Matrix<T, Alloc>&& l, Matrix<T, Alloc>&& r)
     {
-        Matrix<T> res(std::move(l));
+        Matrix<T, Alloc> res(std::move(l));
         res -= r;
         return res;
     }
 
 
-    template <typename T>
-    Matrix<T> operator * (const Matrix<T>& m, const T& number)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator * (const Matrix<T, Alloc>& m, const T& number)
     {
-        Matrix<T> res(m);
+        Matrix<T, Alloc> res(m);
         res.mul(number);
         return res;
     }
-    template <typename T>
-    Matrix<T> operator * (Matrix<T>&& m, const T& number)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator * (Matrix<T, Alloc>&& m, const T& number)
     {
-        Matrix<T> res(std::move(m));
+        Matrix<T, Alloc> res(std::move(m));
         res.mul(number);
         return res;
     }
-    template <typename T>
-    Matrix<T> operator * (const T& number, const Matrix<T>& m)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator * (const T& number, const Matrix<T, Alloc>& m)
     {
-        Matrix<T> res(m);
+        Matrix<T, Alloc> res(m);
         res.mul(number);
         return res;
     }
-    template <typename T>
-    Matrix<T> operator * (const T& number, Matrix<T>&& m)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator * (const T& number, Matrix<T, Alloc>&& m)
     {
-        Matrix<T> res(std::move(m));
+        Matrix<T, Alloc> res(std::move(m));
         res.mul(number);
         return res;
     }
 
 
-    template <typename T>
-    Matrix<T>& Matrix<T>::multiply(const Matrix& m)&
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc>& Matrix<T, Alloc>::multiply(const Matrix& m)&
     {
 
         if (columns_ != m.rows_)
             throw std::logic_error("matrix sizes are not valid for their composition");
 
-        Matrix<T> res(rows_, m.columns_);
+        Matrix<T, Alloc> res(rows_, m.columns_, T{}, alloc_);
 
         for (int r = 0; r < rows_; r++)
         {
@@ -492,31 +500,31 @@ class Matrix final : private Buf<T> {
         return *this;
     }
 
-    template <typename T>
-    Matrix<T> operator * (const Matrix<T>& l, const Matrix<T>& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator * (const Matrix<T, Alloc>& l, const Matrix<T, Alloc>& r)
     {
-        Matrix<T> res(l);
+        Matrix<T, Alloc> res(l);
         res.multiply(r);
         return res;
     }
-    template <typename T>
-    Matrix<T> operator * (const Matrix<T>& l, Matrix<T>&& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator * (const Matrix<T, Alloc>& l, Matrix<T, Alloc>&& r)
     {
-        Matrix<T> res(std::move(r));
+        Matrix<T, Alloc> res(std::move(r));
         res.multiply(l);
         return res;
     }
-    template <typename T>
-    Matrix<T> operator * (Matrix<T>&& l, const Matrix<T>& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator * (Matrix<T, Alloc>&& l, const Matrix<T, Alloc>& r)
     {
-        Matrix<T> res(std::move(l));
+        Matrix<T, Alloc> res(std::move(l));
         res.multiply(r);
         return res;
     }
-    template <typename T>
-    Matrix<T> operator * (Matrix<T>&& l, Matrix<T>&& r)
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> operator * (Matrix<T, Alloc>&& l, Matrix<T, Alloc>&& r)
     {
-        Matrix<T> res(std::move(l));
+        Matrix<T, Alloc> res(std::move(l));
         res.multiply(r);
         return res;
     }
@@ -524,18 +532,18 @@ class Matrix final : private Buf<T> {
     // (+=, -=, *=, =, -, *).......................end
 
 
-    template<typename T>
-    Matrix<T> Matrix<T>::operator -() const& {
+    template<typename T, typename Alloc>
+    Matrix<T, Alloc> Matrix<T, Alloc>::operator -() const& {
 
-        Matrix<T> res(*this);
+        Matrix<T, Alloc> res(*this);
         res.negate();
 
         return res;
     }
 
-    template <typename T>
-    template <typename U>
-    bool Matrix<T>::operator == (const Matrix<U>& m) const {
+    template <typename T, typename Alloc>
+    template <typename U, typename A>
+    bool Matrix<T, Alloc>::operator == (const Matrix<U, A>& m) const {
 
         if (columns_ != m.GetColumns() || rows_ != m.GetRows())
             return false;
@@ -551,32 +559,32 @@ class Matrix final : private Buf<T> {
         return true;
     }
 
-    template <typename T>
-    template <typename U>
-    bool Matrix<T>::operator != (const Matrix<U>& m) const {
+    template <typename T, typename Alloc>
+    template <typename U, typename A>
+    bool Matrix<T, Alloc>::operator != (const Matrix<U, A>& m) const {
         return !(*this == m);
     }
 
 
 
 
-    template <typename T>
-    void Matrix<T>::SwapRows(size_t r1, size_t r2) {
+    template <typename T, typename Alloc>
+    void Matrix<T, Alloc>::SwapRows(size_t r1, size_t r2) {
 
         for (size_t j = 0; j < columns_; j++)
             std::swap(at(r1, j), at(r2, j));
     }
 
 
-    template <typename T>
-    void Matrix<T>::SwapColumns(size_t c1, size_t c2) {
+    template <typename T, typename Alloc>
+    void Matrix<T, Alloc>::SwapColumns(size_t c1, size_t c2) {
 
         for (size_t i = 0; i < rows_; i++)
             std::swap(at(i, c1), at(i, c2));
     }
 
-    template <typename T>
-    T Matrix<T>::trace() const {
+    template <typename T, typename Alloc>
+    T Matrix<T, Alloc>::trace() const {
 
         if (rows_ != columns_)
             throw std::logic_error("Only the square matrix has a trace");
@@ -592,8 +600,8 @@ class Matrix final : private Buf<T> {
         return res;
     }
 
-    template <typename T>
-    Matrix<T>& Matrix<T>::transpose()& {
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc>& Matrix<T, Alloc>::transpose()& {
 
         if (!rows_ || !columns_)
             return *this;
@@ -620,14 +628,14 @@ class Matrix final : private Buf<T> {
     }
 
 
-    template <typename T>
-    Matrix<T> Matrix<T>::GetMinor(size_t row, size_t col) const {
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc> Matrix<T, Alloc>::GetMinor(size_t row, size_t col) const {
 
         if (!size_)
             throw std::logic_error("the null matrix has no submatrix");
 
 
-        Matrix<T> res(columns_ - 1, rows_ - 1);
+        Matrix<T, Alloc> res(columns_ - 1, rows_ - 1, T{}, alloc_);
 
         for (int i = 0, i_res = 0; i < rows_; i++) {
 
@@ -648,8 +656,8 @@ class Matrix final : private Buf<T> {
         return res;
     }
 
-    template <typename T>
-    Matrix<T>& Matrix<T>::negate()& {
+    template <typename T, typename Alloc>
+    Matrix<T, Alloc>& Matrix<T, Alloc>::negate()& {
 
         for (int i = 0; i < size_; i++)
             data_[i] = -data_[i];
@@ -658,8 +666,8 @@ class Matrix final : private Buf<T> {
     }
 
 
-    template <typename T>
-    double Matrix<T>::determinant() const {
+    template <typename T, typename Alloc>
+    double Matrix<T, Alloc>::determinant() const {
 
         double res = 0.0;
 
@@ -679,8 +687,8 @@ class Matrix final : private Buf<T> {
     }
 
 
-    template <typename T>
-    double Matrix<T>::determinantGaus() const {
+    template <typename T, typename Alloc>
+    double Matrix<T, Alloc>::determinantGaus() const {
 
         if (rows_ != columns_)
             throw std::logic_error("Only the square matrix has a determinant");
@@ -716,13 +724,13 @@ class Matrix final : private Buf<T> {
         return copy_m.trace() * res_sign;
     }
 
-    template<typename T>
-    void Matrix<T>::clear() {
-        *this = Matrix<T>();
+    template<typename T, typename Alloc>
+    void Matrix<T, Alloc>::clear() {
+        *this = Matrix<T, Alloc>(alloc_);
     }
 
-    template<typename T>
-    void Matrix<T>::Print() const {
+    template<typename T, typename Alloc>
+    void Matrix<T, Alloc>::Print() const {
 
         std::cout<<"________________________________________\n";
         std::cout<<"rows: "<<rows_<<" columns: "<<columns_<<"\n";
@@ -738,8 +746,8 @@ class Matrix final : private Buf<T> {
         std::cout<<"________________________________________\n";
     }
 
-    template<typename T>
-    std::ostream& operator<<(std::ostream& os, const Matrix<T>& m) {
+    template<typename T, typename Alloc>
+    std::ostream& operator<<(std::ostream& os, const Matrix<T, Alloc>& m) {
 
         os << m.GetRows()<<" "<<m.GetColumns()<<"\n";
 
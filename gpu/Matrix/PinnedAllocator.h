@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Allocators.h"
+
+#ifdef __APPLE__
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+
+#include <memory>
+#include <new>
+#include <unordered_map>
+
+namespace linal {
+
+    // Host memory the device transfers from without a staging copy: every allocation is a CL_MEM_ALLOC_HOST_PTR
+    // buffer mapped for the host. GetBuffer gives the device buffer behind an allocation, e.g. a Matrix::data(),
+    // to be passed to kernels or copied from by the device. Copies of the allocator share its buffers.
+    class PinnedAllocator {
+    public:
+        PinnedAllocator(const cl::Context& context, const cl::CommandQueue& queue)
+            : context_(context), queue_(queue), buffers_(std::make_shared<Buffers>()) {}
+
+        void* Allocate(size_t bytes, size_t) {
+
+            cl_int err = CL_SUCCESS;
+            cl::Buffer buffer(context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes, nullptr, &err);
+            if (err != CL_SUCCESS)
+                throw std::bad_alloc();
+
+            void* ptr = queue_.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes, nullptr, nullptr, &err);
+            if (err != CL_SUCCESS || !ptr)
+                throw std::bad_alloc();
+
+            buffers_->emplace(ptr, std::move(buffer));
+            return ptr;
+        }
+
+        void Deallocate(void* ptr, size_t, size_t) noexcept {
+
+            const auto it = buffers_->find(ptr);
+            if (it == buffers_->end())
+                return;
+
+            queue_.enqueueUnmapMemObject(it->second, ptr);
+            queue_.finish();
+            buffers_->erase(it);
+        }
+
+        // the buffer of memory returned by Allocate, a null buffer for any other pointer
+        cl::Buffer GetBuffer(const void* ptr) const {
+            const auto it = buffers_->find(ptr);
+            return it == buffers_->end() ? cl::Buffer() : it->second;
+        }
+
+    private:
+        using Buffers = std::unordered_map<const void*, cl::Buffer>;
+
+        cl::Context context_;
+        cl::CommandQueue queue_;
+        std::shared_ptr<Buffers> buffers_;
+    };
+
+}
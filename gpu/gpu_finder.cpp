@@ -1,209 +1,1566 @@
 #include "gpu_finder.h"
+#include "match_cl.h" // generated from gpu/match.cl at build time
+#include "Matrix/PinnedAllocator.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <system_error>
+#include <tuple>
+#include <unordered_map>
+
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+    // first nonzero answer in [n, end), end if there is none; zero runs are skipped 16 answers at a time
+    size_t NextAnswer(const cl_uint* answers, size_t n, size_t end) {
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        for (; n + 16 <= end; n += 16) {
+            const auto* block = reinterpret_cast<const __m128i*>(answers + n);
+            const __m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(block), _mm_loadu_si128(block + 1)),
+                                             _mm_or_si128(_mm_loadu_si128(block + 2), _mm_loadu_si128(block + 3)));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF)
+                break;
+        }
+#endif
+        while (n < end && !answers[n])
+            ++n;
+        return n;
+    }
+
+    // length of the common prefix of a and b, 8 bytes at a time up to the first differing word
+    size_t CommonPrefix(const char* a, const char* b, size_t size) {
+        size_t k = 0;
+        for (uint64_t x = 0, y = 0; k + 8 <= size; k += 8) {
+            std::memcpy(&x, a + k, 8);
+            std::memcpy(&y, b + k, 8);
+            if (x != y)
+                break;
+        }
+        while (k < size && a[k] == b[k])
+            ++k;
+        return k;
+    }
+
+    // bytes [6, 14) of a text position, as many of them as the text has
+    uint64_t LoadTail(std::string_view text, size_t n) {
+        uint64_t word = 0;
+        std::memcpy(&word, text.data() + n + 6, text.size() - n >= 14 ? 8 : text.size() - n - 6);
+        return word;
+    }
+
+    // a pattern given twice is matched once on the device: every match of the counted one is copied to the others,
+    // duplicates are (id, id counted on the device)
+    template <typename Match>
+    void CopyDuplicates(const std::vector<std::pair<size_t, size_t>>& duplicates, std::vector<Match>& matches) {
+        if (duplicates.empty())
+            return;
+
+        std::unordered_multimap<size_t, size_t> copies;
+        for (const auto& [id, counted] : duplicates)
+            copies.emplace(counted, id);
+
+        const size_t found = matches.size();
+        for (size_t i = 0; i < found; ++i) {
+            const auto [first, last] = copies.equal_range(matches[i].pattern);
+            for (auto it = first; it != last; ++it) {
+                auto copy = matches[i];
+                copy.pattern = it->second;
+                matches.push_back(copy);
+            }
+        }
+    }
+}
 
 PatternMatchingGPU::PatternMatchingGPU(const std::vector<std::string>& patterns, const std::string &kernel_name):
-    patterns_(patterns), kernel_name_(kernel_name) {
+    PatternMatchingGPU(patterns, Options{}, kernel_name) {}
+
+PatternMatchingGPU::PatternMatchingGPU(const std::vector<std::string>& patterns, const Options& options, const std::string &kernel_name):
+    PatternMatchingGPU(PatternDatabase(patterns), options, kernel_name) {}
+
+PatternMatchingGPU::PatternMatchingGPU(PatternDatabase database, const std::string &kernel_name):
+    PatternMatchingGPU(std::move(database), Options{}, kernel_name) {}
+
+PatternMatchingGPU::PatternMatchingGPU(PatternDatabase database, const Options& options, const std::string &kernel_name):
+    PatternMatchingGPU(std::make_shared<const PatternDatabase>(std::move(database)), ChooseDefaultDevice(), options, kernel_name) {}
 
-    // ChoosePlatformAndDevice();
-    ChooseDefaultPlatformAndDevice();
+PatternMatchingGPU::PatternMatchingGPU(std::shared_ptr<const PatternDatabase> database, const cl::Device& device,
+                                       const Options& options, const std::string &kernel_name):
+    device_(device), kernel_name_(kernel_name), options_(options), database_(std::move(database)),
+    patterns_(database_->GetPatterns()), short_patterns_(patterns_, 5), maxdepth(database_->GetMaxDepth()) {
+
+    if (patterns_.empty())
+        throw std::invalid_argument("Count of patterns = 0");
 
     context_ = cl::Context({device_});
-    queue_ = cl::CommandQueue(context_, device_);
+    queue_ = cl::CommandQueue(context_, device_, CL_QUEUE_PROFILING_ENABLE);
+    transfer_queue_ = cl::CommandQueue(context_, device_);
+    host_unified_memory_ = device_.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+
+    for (size_t i = 0; i < patterns_.size(); ++i) {
+        max_length_ = std::max(max_length_, patterns_[i].size());
+        if (!patterns_[i].empty() && patterns_[i].size() <= 5)
+            short_ids_.push_back(i);
+    }
+    removed_.assign(patterns_.size(), false);
+
+    // only host verification has work for the CPU threads
+    if (options_.verification == Verification::Host) {
+        ComputeTails();
+        if (options_.index == Index::Hash)
+            SortGroups();
+
+        const size_t threads = options_.threads ? options_.threads : std::thread::hardware_concurrency();
+        if (threads > 1)
+            pool_ = std::make_unique<ThreadPool>(threads);
+    }
+
+    std::string program_string(match_cl_source);
 
-    std::ifstream program_sources(kernel_name_);
-    if (!program_sources.is_open())
-        throw std::runtime_error("Can't open file: " + kernel_name);
+    if (!kernel_name_.empty()) {
+        std::ifstream program_sources(kernel_name_);
+        if (!program_sources.is_open())
+            throw std::runtime_error("Can't open file: " + kernel_name);
 
-    std::ostringstream ostr;
-    ostr << program_sources.rdbuf();
-    program_sources.close();
-    std::string program_string(ostr.str());
+        std::ostringstream ostr;
+        ostr << program_sources.rdbuf();
+        program_sources.close();
+        program_string = ostr.str();
+    }
+
+    program_ = ProgramCache(options_.program_cache).Build(context_, device_, program_string, "");
+
+    const auto offsets = database_->GetPatternOffsets();
+    pattern_offsets_.assign(offsets, offsets + patterns_.size() + 1);
+
+    // patterns of up to 5 bytes have no tables, they are left to short_count or the host
+    const bool hashed = options_.index == Index::Hash;
+    if (hashed) {
+        if (maxdepth)
+            UploadHashIndex();
+    } else {
+        UploadSignatureTables();
+    }
+
+    work_group_size_ = std::min(work_group_size_, device_.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+
+    // the tile and the counters of a work-group share its local memory
+    const bool tiled = !hashed && options_.positions_per_item;
+    if (tiled && GetTileSize() + 2 * work_group_size_ * sizeof(cl_uint) > device_.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>())
+        throw std::invalid_argument("Positions per work-item don't fit the local memory");
 
-    program_ = cl::Program(context_, program_string);
-    program_.build();
+    if (options_.verification == Verification::Device) {
+        UploadPatterns();
 
-    BuildPatternTable();
-    BuildSignatureTables();
+        count_kernel_ = cl::Kernel(program_, hashed ? "hash_count" : tiled ? "signature_count_tiled" : "signature_count");
+        UploadShortTables();
+    } else {
+        kernel_ = cl::Kernel(program_, hashed ? "hash_match" : tiled ? "signature_match_tiled" : "signature_match");
+    }
 }
 
-std::vector<size_t> PatternMatchingGPU::Match(const std::string& text, size_t& time) const {
+std::vector<size_t> PatternMatchingGPU::Match(std::string_view text, size_t& time) const {
+    return Match(text, text.size(), time);
+}
 
-    auto res = FindSmallPatterns(text);
+std::vector<size_t> PatternMatchingGPU::Match(std::string_view text, size_t limit, size_t& time) const {
 
-    cl::Buffer text_buffer(context_, CL_MEM_READ_ONLY, text.size() * sizeof(std::char_traits<char>));
-    queue_.enqueueWriteBuffer(text_buffer, CL_TRUE, 0, text.size() * sizeof(std::char_traits<char>), text.data());
+    Timing timing;
+    auto res = Match(text, limit, timing);
+    time = timing.total;
 
-    std::vector<cl::Event> events(maxdepth);
-    const cl::NDRange global_size(text.size() / 2 + text.size() % 2);
-
-    std::vector<cl::Buffer> answer_buffers(maxdepth);
-    std::transform(answer_buffers.begin()
-                   , answer_buffers.end()
-                   , answer_buffers.begin()
-                   , [context = context_, size = text.size()](auto& buf) {
-        return cl::Buffer(context, CL_MEM_WRITE_ONLY, size * sizeof(cl_float2));
+    return res;
+}
+
+std::vector<size_t> PatternMatchingGPU::Match(std::string_view text, Timing& timing) const {
+    return Match(text, text.size(), timing);
+}
+
+std::vector<size_t> PatternMatchingGPU::Match(std::string_view text, size_t limit, Timing& timing) const {
+
+    if (limit > text.size())
+        throw std::invalid_argument("Match limit is out of the text");
+
+    timing = {};
+
+    // the short patterns are left to the short_count kernel when there is one
+    auto begin = std::chrono::steady_clock::now();
+    auto res = short_kernel_() ? std::vector<size_t>(patterns_.size()) : FindSmallPatterns(text, limit);
+    timing.short_patterns = std::chrono::nanoseconds(std::chrono::steady_clock::now() - begin).count();
+
+    if (!limit)
+        return res;
+
+    if (text.size() > std::numeric_limits<cl_uint>::max() - host_ptr_alignment_)
+        throw std::length_error("Text is too long for 32-bit positions");
+
+    std::lock_guard lock(session_mutex_);
+    ReserveBuffers(text.size());
+
+    // commands are profiled until the call returns, whichever way it does
+    struct Profiling {
+        const PatternMatchingGPU& gpu;
+        ~Profiling() { gpu.timing_ = nullptr; gpu.profiled_.clear(); }
+    } profiling{*this};
+    timing_ = &timing;
+
+    size_t text_offset = 0;
+    const auto text_buffer = UploadText(text, text_offset);
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    if (options_.verification == Verification::Device)
+        MatchOnDevice(text_buffer, text_offset, text, limit, res);
+    else
+        MatchOnHost(text_buffer, text_offset, text, limit, res);
+
+    auto finish_time = std::chrono::steady_clock::now();
+    timing.total = std::chrono::nanoseconds(finish_time - start_time).count();
+
+    // the last command was a blocking read, so every profiled one is complete
+    CollectTiming();
+
+    return res;
+}
+
+cl::Event* PatternMatchingGPU::Profile(const char* name, size_t table) const {
+
+    if (!timing_)
+        return nullptr;
+
+    profiled_.push_back({Stage{name, table}, cl::Event()});
+    return &profiled_.back().second;
+}
+
+void PatternMatchingGPU::Profile(const cl::Event& event, const char* name, size_t table) const {
+
+    if (timing_)
+        profiled_.push_back({Stage{name, table}, event});
+}
+
+void PatternMatchingGPU::CollectTiming() const {
+
+    for (auto& [stage, event] : profiled_) {
+        stage.queued = event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+        stage.submit = event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+        stage.start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        stage.end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+        timing_->stages.push_back(std::move(stage));
+    }
+    profiled_.clear();
+
+    std::stable_sort(timing_->stages.begin(), timing_->stages.end(), [](const Stage& a, const Stage& b) {
+        return a.queued < b.queued;
     });
+}
 
-    const size_t matrix_size = SignatureTables::n_;
-    cl::Buffer table_buf(context_, CL_MEM_READ_ONLY, matrix_size * matrix_size * sizeof(cl_float4));
+cl::Buffer PatternMatchingGPU::UploadText(std::string_view text, size_t& text_offset) const {
 
-    cl::Kernel kernel_(program_, "signature_match");
-    kernel_.setArg(0, text_buffer);
-    kernel_.setArg(1, static_cast<cl_uint>(text.size()));
+    cl::Buffer text_buffer;
+    text_offset = 0;
 
-    auto start_time = std::chrono::system_clock::now();
+    if (host_unified_memory_) {
+        // zero-copy wrapping wants an aligned pointer, so the buffer starts at the beginning of the text's page;
+        // the page is mapped as a whole, and the kernels skip the bytes before the text
+        text_offset = reinterpret_cast<uintptr_t>(text.data()) % host_ptr_alignment_;
 
-    for(std::size_t i = 0; i < maxdepth; ++i) {
+        cl_int err = CL_SUCCESS;
+        text_buffer = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, text_offset + text.size(),
+                                 const_cast<char*>(text.data() - text_offset), &err);
+        if (err != CL_SUCCESS)
+            text_buffer = cl::Buffer();
+    }
 
-        queue_.enqueueWriteBuffer(table_buf, CL_TRUE, 0, matrix_size * matrix_size * sizeof(cl_float4), signatures_.GetData(i));
+    if (!text_buffer()) {
+        // a unified device may still refuse some memory, then it gets a pooled copy like a discrete one
+        if (host_unified_memory_ && !text_refused_) {
+            text_refused_ = true;
+            text_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY, buffers_capacity_ * sizeof(std::char_traits<char>));
+        }
 
-        kernel_.setArg(2, answer_buffers[i]);
-        kernel_.setArg(3, table_buf);
+        text_buffer = text_buffer_;
+        text_offset = 0;
 
-        queue_.enqueueNDRangeKernel(kernel_,  cl::NDRange(0), global_size, cl::NullRange, nullptr, &events.at(i));
+        // the in-order queue finishes the upload before the kernels, and `text` outlives the blocking reads after them
+        queue_.enqueueWriteBuffer(text_buffer_, CL_FALSE, 0, text.size() * sizeof(std::char_traits<char>), text.data(),
+                                  nullptr, Profile("upload text"));
     }
 
-    // answer[i] shows i, j - first two symbols of possible pattern, which can start from text[i]
-    std::vector<cl_float2> answers(text.size());
+    return text_buffer;
+}
 
-    for(std::size_t step = 0; step < maxdepth; ++step) {
+std::vector<PatternMatchingGPU::Position> PatternMatchingGPU::MatchPositions(std::string_view text, size_t& time,
+                                                                             size_t cap, bool* overflow) const {
 
-        events[step].wait();
-        queue_.enqueueReadBuffer(answer_buffers[step], CL_TRUE, 0, answers.size() * sizeof(cl_float2), answers.data());
+    if (options_.verification != Verification::Device)
+        throw std::logic_error("Position matching requires device verification");
+
+    if (cap >= std::numeric_limits<cl_uint>::max())
+        throw std::length_error("Positions cap is too big for 32-bit places");
+
+    std::vector<Position> res;
+    size_t found = 0, read = 0;
 
-        CheckAnswers(text, answers, step, res);
+    time = 0;
+    if (!text.empty()) {
+        if (text.size() > std::numeric_limits<cl_uint>::max() - host_ptr_alignment_)
+            throw std::length_error("Text is too long for 32-bit positions");
+
+        std::lock_guard lock(session_mutex_);
+        ReserveBuffers(text.size());
+        ReservePositions(cap ? cap : 1 << 16);
+
+        size_t text_offset = 0;
+        const auto text_buffer = UploadText(text, text_offset);
+
+        auto start_time = std::chrono::system_clock::now();
+
+        // with a cap only that many places are filled, otherwise the text runs again with room for every match
+        const cl_uint zero = 0;
+        cl_uint count = 0;
+
+        for (;;) {
+            queue_.enqueueWriteBuffer(positions_count_buffer_, CL_FALSE, 0, sizeof(cl_uint), &zero);
+            EnqueuePositions(text_buffer, text_offset, text.size(), cap ? cap : positions_capacity_);
+            queue_.enqueueReadBuffer(positions_count_buffer_, CL_TRUE, 0, sizeof(cl_uint), &count);
+
+            if (cap || count <= positions_capacity_)
+                break;
+
+            ReservePositions(count);
+        }
+
+        found = count;
+        read = std::min<size_t>(count, cap ? cap : positions_capacity_);
+
+        positions_.resize(read * 2);
+        if (read)
+            queue_.enqueueReadBuffer(positions_buffer_, CL_TRUE, 0, positions_.size() * sizeof(cl_uint), positions_.data());
+
+        auto finish_time = std::chrono::system_clock::now();
+        time = (finish_time - start_time).count();
+
+        for (size_t i = 0; i < read; ++i)
+            res.push_back({positions_[i * 2], positions_[i * 2 + 1]});
     }
-    auto finish_time = std::chrono::system_clock::now();
-    time = (finish_time - start_time).count();
+
+    // copies of the matches read are exact, so only the device can have found more than those
+    CopyDuplicates(short_duplicates_, res);
+    if (overflow)
+        *overflow = cap && (found > read || res.size() > cap);
+
+    // places are taken in no particular order
+    std::sort(res.begin(), res.end(), [](const Position& a, const Position& b) {
+        return std::tie(a.offset, a.pattern) < std::tie(b.offset, b.pattern);
+    });
+
+    if (cap && res.size() > cap)
+        res.resize(cap);
 
     return res;
 }
 
-void PatternMatchingGPU::CheckAnswers
-    (const std::string& text, const std::vector<cl_float2>& answers, size_t step, std::vector<size_t>& res) const {
-    for (size_t n = 0; n < text.size() - 2; ++n) {
-        const cl_float2 coordinates = answers[n];
+void PatternMatchingGPU::ReservePositions(size_t capacity) const {
 
-        //const auto i = static_cast<u_char>(static_cast<char>(coordinates.s[0]));
-        //const auto j = static_cast<u_char>(static_cast<char>(coordinates.s[1]));
+    if (!positions_kernel_()) {
+        positions_kernel_ = cl::Kernel(program_, options_.index == Index::Hash ? "hash_positions" : "signature_positions");
+        positions_count_buffer_ = cl::Buffer(context_, CL_MEM_READ_WRITE, sizeof(cl_uint));
+    }
 
-        const auto i = static_cast<u_char>(static_cast<char>(coordinates.s[0]));
-        const auto j = static_cast<u_char>(static_cast<char>(coordinates.s[1]));
+    if (short_kernel_() && !short_positions_kernel_())
+        short_positions_kernel_ = cl::Kernel(program_, "short_positions");
 
-        if(i && j) {
+    if (capacity <= positions_capacity_)
+        return;
 
-            const std::size_t pattern_idx = Pattern_table.at(i,j)[step];
-            const auto& pat = patterns_[pattern_idx];
+    positions_capacity_ = capacity;
+    positions_buffer_ = cl::Buffer(context_, CL_MEM_WRITE_ONLY, positions_capacity_ * 2 * sizeof(cl_uint));
+}
 
-            int k = 6;
-            for (; k < pat.size() && pat[k] == text[n + k]; ++k);
+void PatternMatchingGPU::EnqueuePositions(const cl::Buffer& text, size_t offset, size_t size, size_t capacity) const {
+
+    const size_t items = size / 2 + size % 2;
+    const cl::NDRange global_size((items + work_group_size_ - 1) / work_group_size_ * work_group_size_);
+    const cl::NDRange local_size(work_group_size_);
+
+    // short patterns first, both kernels append to the same places
+    if (short_kernel_()) {
+        short_positions_kernel_.setArg(0, text);
+        short_positions_kernel_.setArg(1, static_cast<cl_uint>(offset));
+        short_positions_kernel_.setArg(2, static_cast<cl_uint>(size));
+        short_positions_kernel_.setArg(3, static_cast<cl_uint>(size));
+        short_positions_kernel_.setArg(4, short_direct_buffer_);
+        short_positions_kernel_.setArg(5, short_prefixes_buffer_);
+        short_positions_kernel_.setArg(6, short_slots_buffer_);
+        short_positions_kernel_.setArg(7, short_slots_mask_);
+        short_positions_kernel_.setArg(8, short_probes_);
+        short_positions_kernel_.setArg(9, short_lengths_);
+        short_positions_kernel_.setArg(10, positions_buffer_);
+        short_positions_kernel_.setArg(11, positions_count_buffer_);
+        short_positions_kernel_.setArg(12, static_cast<cl_uint>(capacity));
+        short_positions_kernel_.setArg(13, cl::Local(2 * sizeof(cl_uint)));
+
+        queue_.enqueueNDRangeKernel(short_positions_kernel_, cl::NDRange(0), global_size, local_size);
+    }
 
-            if (k == pat.size())
-                ++res[pattern_idx];
-        }
+    positions_kernel_.setArg(0, text);
+    positions_kernel_.setArg(1, static_cast<cl_uint>(offset));
+    positions_kernel_.setArg(2, static_cast<cl_uint>(size));
+    positions_kernel_.setArg(3, static_cast<cl_uint>(size));
 
+    if (!maxdepth)
+        return;
+
+    if (options_.index == Index::Hash) {
+        positions_kernel_.setArg(4, slots_buffer_);
+        positions_kernel_.setArg(5, static_cast<cl_uint>(database_->GetHashBucketsCount() - 1));
+        positions_kernel_.setArg(6, static_cast<cl_ulong>(database_->GetHashSeed()));
+        positions_kernel_.setArg(7, group_offsets_buffer_);
+        positions_kernel_.setArg(8, group_patterns_buffer_);
+        positions_kernel_.setArg(9, patterns_buffer_);
+        positions_kernel_.setArg(10, pattern_offsets_buffer_);
+        positions_kernel_.setArg(11, positions_buffer_);
+        positions_kernel_.setArg(12, positions_count_buffer_);
+        positions_kernel_.setArg(13, static_cast<cl_uint>(capacity));
+        positions_kernel_.setArg(14, cl::Local(2 * sizeof(cl_uint)));
+
+        queue_.enqueueNDRangeKernel(positions_kernel_, cl::NDRange(0), global_size, local_size);
+        return;
+    }
+
+    positions_kernel_.setArg(4, bucket_offsets_buffer_);
+    positions_kernel_.setArg(5, entries_buffer_);
+    positions_kernel_.setArg(7, patterns_buffer_);
+    positions_kernel_.setArg(8, pattern_offsets_buffer_);
+    positions_kernel_.setArg(9, positions_buffer_);
+    positions_kernel_.setArg(10, positions_count_buffer_);
+    positions_kernel_.setArg(11, static_cast<cl_uint>(capacity));
+    positions_kernel_.setArg(12, cl::Local(2 * sizeof(cl_uint)));
+
+    // the tables append to the same places one launch after another
+    for (size_t i = 0; i < maxdepth; ++i) {
+        positions_kernel_.setArg(6, static_cast<cl_uint>(i));
+        queue_.enqueueNDRangeKernel(positions_kernel_, cl::NDRange(0), global_size, local_size);
     }
 }
 
+void PatternMatchingGPU::MatchOnDevice(const cl::Buffer& text_buffer, size_t text_offset, std::string_view text,
+                                       size_t limit, std::vector<size_t>& res) const {
 
-std::vector<size_t> PatternMatchingGPU::FindSmallPatterns(const std::string& text) const {
+    ResetCounts();
+    EnqueueCount(text_buffer, text_offset, text.size(), limit);
+    ReadCounts(res);
+}
 
-    std::vector<size_t> res(patterns_.size());
+void PatternMatchingGPU::ResetCounts() const {
 
-    for (size_t i = 0; i < patterns_.size(); ++i) {
-        auto&& pat = patterns_.at(i);
-        if (pat.size() < 6) {
+    counts_.assign(patterns_.size(), counts_start_);
+    queue_.enqueueWriteBuffer(counts_buffer_, CL_FALSE, 0, counts_.size() * sizeof(cl_uint), counts_.data(),
+                              nullptr, Profile("reset counts"));
+}
+
+void PatternMatchingGPU::EnqueueCount(const cl::Buffer& text, size_t offset, size_t size, size_t limit,
+                                      const std::vector<cl::Event>* wait, cl::Event* done) const {
+
+    const size_t items = limit / 2 + limit % 2;
+    const cl::NDRange global_size((items + work_group_size_ - 1) / work_group_size_ * work_group_size_);
+    const cl::NDRange local_size(work_group_size_);
+
+    if (short_kernel_()) {
+        short_kernel_.setArg(0, text);
+        short_kernel_.setArg(1, static_cast<cl_uint>(offset));
+        short_kernel_.setArg(2, static_cast<cl_uint>(size));
+        short_kernel_.setArg(3, static_cast<cl_uint>(limit));
+        short_kernel_.setArg(4, short_direct_buffer_);
+        short_kernel_.setArg(5, short_prefixes_buffer_);
+        short_kernel_.setArg(6, short_slots_buffer_);
+        short_kernel_.setArg(7, short_slots_mask_);
+        short_kernel_.setArg(8, short_probes_);
+        short_kernel_.setArg(9, short_lengths_);
+        short_kernel_.setArg(10, counts_buffer_);
+        short_kernel_.setArg(11, cl::Local(work_group_size_ * sizeof(cl_uint)));
+        short_kernel_.setArg(12, cl::Local(work_group_size_ * sizeof(cl_uint)));
+
+        queue_.enqueueNDRangeKernel(short_kernel_, cl::NDRange(0), global_size, local_size, wait,
+                                    !maxdepth && done ? done : Profile("short count"));
+        wait = nullptr;
+    }
+
+    if (!maxdepth)
+        return;
+
+    count_kernel_.setArg(0, text);
+    count_kernel_.setArg(1, static_cast<cl_uint>(offset));
+    count_kernel_.setArg(2, static_cast<cl_uint>(size));
+    count_kernel_.setArg(3, static_cast<cl_uint>(limit));
+
+    if (options_.index == Index::Hash) {
+        count_kernel_.setArg(4, slots_buffer_);
+        count_kernel_.setArg(5, static_cast<cl_uint>(database_->GetHashBucketsCount() - 1));
+        count_kernel_.setArg(6, static_cast<cl_ulong>(database_->GetHashSeed()));
+        count_kernel_.setArg(7, group_offsets_buffer_);
+        count_kernel_.setArg(8, group_patterns_buffer_);
+        count_kernel_.setArg(9, patterns_buffer_);
+        count_kernel_.setArg(10, pattern_offsets_buffer_);
+        count_kernel_.setArg(11, counts_buffer_);
+        count_kernel_.setArg(12, cl::Local(work_group_size_ * sizeof(cl_uint)));
+        count_kernel_.setArg(13, cl::Local(work_group_size_ * sizeof(cl_uint)));
+
+        queue_.enqueueNDRangeKernel(count_kernel_, cl::NDRange(0), global_size, local_size, wait,
+                                    done ? done : Profile("count"));
+        return;
+    }
+
+    count_kernel_.setArg(4, bucket_offsets_buffer_);
+    count_kernel_.setArg(5, entries_buffer_);
+    count_kernel_.setArg(7, patterns_buffer_);
+    count_kernel_.setArg(8, pattern_offsets_buffer_);
+    count_kernel_.setArg(9, counts_buffer_);
+    count_kernel_.setArg(10, cl::Local(work_group_size_ * sizeof(cl_uint)));
+    count_kernel_.setArg(11, cl::Local(work_group_size_ * sizeof(cl_uint)));
+
+    cl::NDRange tables_size = global_size;
+    if (options_.positions_per_item) {
+        count_kernel_.setArg(12, static_cast<cl_uint>(options_.positions_per_item));
+        count_kernel_.setArg(13, cl::Local(GetTileSize()));
+        tables_size = GetTiledRange(limit);
+    }
+
+    // the queue is in-order, so only the first launch has to wait and only the last one signals
+    for (size_t i = 0; i < maxdepth; ++i) {
+        count_kernel_.setArg(6, static_cast<cl_uint>(i));
+        queue_.enqueueNDRangeKernel(count_kernel_, cl::NDRange(0), tables_size, local_size,
+                                    i == 0 ? wait : nullptr, i + 1 == maxdepth && done ? done : Profile("count", i));
+    }
+}
+
+void PatternMatchingGPU::ReadCounts(std::vector<size_t>& res) const {
+
+    read_counts_.resize(counts_.size());
+    queue_.enqueueReadBuffer(counts_buffer_, CL_TRUE, 0, read_counts_.size() * sizeof(cl_uint), read_counts_.data(),
+                             nullptr, Profile("read counts"));
+
+    AddCounts(read_counts_, res);
+}
 
-            auto pos = text.find(pat);
-            while (pos != std::string::npos) {
-                ++res[i];
-                pos = text.find(pat, pos + 1);
+void PatternMatchingGPU::AddCounts(const std::vector<cl_uint>& counts, std::vector<size_t>& res) const {
+
+    // a difference of 32-bit counters is right even if they have wrapped around since the last read,
+    // as long as less than 2^32 matches were counted in between
+    for (const auto& [id, counted] : short_duplicates_)
+        res[id] += static_cast<cl_uint>(counts[counted] - counts_[counted]);
+
+    for (size_t i = 0; i < counts.size(); ++i)
+        res[i] += static_cast<cl_uint>(counts[i] - counts_[i]);
+
+    counts_ = counts;
+}
+
+std::vector<size_t> PatternMatchingGPU::MatchStream(std::istream& in, size_t chunk_size) const {
+
+    return MatchChunks([&in](char* dst, size_t size) {
+        in.read(dst, static_cast<std::streamsize>(size));
+        if (in.bad())
+            throw std::runtime_error("Can't read the text stream");
+        return static_cast<size_t>(in.gcount());
+    }, chunk_size);
+}
+
+std::vector<size_t> PatternMatchingGPU::MatchStream(int fd, size_t chunk_size) const {
+
+    return MatchChunks([fd](char* dst, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            const ssize_t got = ::read(fd, dst + done, size - done);
+            if (got == 0)
+                break;
+            if (got < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "Can't read the text stream");
             }
+            done += static_cast<size_t>(got);
+        }
+        return done;
+    }, chunk_size);
+}
+
+std::vector<size_t> PatternMatchingGPU::MatchChunks(const std::function<size_t(char*, size_t)>& read, size_t chunk_size) const {
+
+    if (options_.verification != Verification::Device)
+        throw std::logic_error("Stream matching requires device verification");
+
+    // every chunk starts with the last max_length_ - 1 bytes of the previous one,
+    // so a match crossing the boundary is whole in the next chunk
+    const size_t overlap = std::max<size_t>(max_length_, 1) - 1;
+    if (chunk_size <= overlap)
+        throw std::invalid_argument("Chunk size must be greater than the longest pattern");
+
+    const size_t capacity = chunk_size + overlap;
+    if (capacity > std::numeric_limits<cl_uint>::max())
+        throw std::length_error("Chunk size is too big for 32-bit positions");
+
+    // chunk k is read into the pinned staging memory of slot k % 2 while chunk k - 1 is uploaded and matched
+    // the counters are read after every chunk: a chunk has less than 2^32 positions, so however long the stream
+    // is, they never gain 2^32 or more between two reads
+    struct Slot {
+        cl::Buffer text;
+        char* host = nullptr;
+        cl::Event uploaded;
+        cl::Event matched;
+        bool busy = false;
+        std::vector<cl_uint> counts;
+        cl::Event read;
+        bool counted = false; // counts holds the read after this slot's last chunk, not yet added
+    };
+    std::array<Slot, 2> slots;
+
+    std::lock_guard lock(session_mutex_);
+
+    // staging memory is released whichever way the call returns, after the uploads from it
+    struct Staging {
+        const PatternMatchingGPU& gpu;
+        std::array<Slot, 2>& slots;
+        linal::PinnedAllocator pinned;
+        size_t capacity;
+
+        ~Staging() {
+            gpu.transfer_queue_.finish();
+            gpu.queue_.finish();
+            for (auto& slot : slots)
+                if (slot.host)
+                    pinned.Deallocate(slot.host, capacity, 1);
+        }
+    } staging{*this, slots, linal::PinnedAllocator(context_, queue_), capacity};
+
+    for (auto& slot : slots) {
+        slot.text = cl::Buffer(context_, CL_MEM_READ_ONLY, capacity);
+        slot.host = static_cast<char*>(staging.pinned.Allocate(capacity, 1));
+        slot.counts.resize(patterns_.size());
+    }
+
+    std::vector<size_t> res(patterns_.size());
+    ResetCounts();
+
+    // reads are added in the order they were taken
+    auto add_counts = [this, &res](Slot& slot) {
+        if (!slot.counted)
+            return;
+        slot.read.wait();
+        AddCounts(slot.counts, res);
+        slot.counted = false;
+    };
+
+    const char* tail = nullptr;
+    size_t carry = 0;
+    bool last = false;
+    size_t k = 0;
+
+    for (; !last; ++k) {
+        auto& slot = slots[k % 2];
+
+        // staging memory is free once its previous upload is done
+        if (slot.busy)
+            slot.uploaded.wait();
+        add_counts(slot);
+
+        if (carry)
+            std::memcpy(slot.host, tail, carry);
+        const size_t got = read(slot.host + carry, chunk_size);
+        last = got < chunk_size;
+
+        const size_t size = carry + got;
+        const size_t limit = last ? size : size - overlap;
+
+        if (!short_kernel_())
+            short_patterns_.Count(std::string_view(slot.host, size), limit, res);
+
+        // with neither tables nor short_count the device has nothing to count
+        if (limit && (maxdepth || short_kernel_())) {
+            // device text buffer is free once the kernels of its previous chunk are done
+            std::vector<cl::Event> matched;
+            if (slot.busy)
+                matched.push_back(slot.matched);
+
+            transfer_queue_.enqueueWriteBuffer(slot.text, CL_FALSE, 0, size, slot.host, &matched, &slot.uploaded);
+            transfer_queue_.flush();
+
+            const std::vector<cl::Event> uploaded{slot.uploaded};
+            EnqueueCount(slot.text, 0, size, limit, &uploaded, &slot.matched);
+            queue_.enqueueReadBuffer(counts_buffer_, CL_FALSE, 0, slot.counts.size() * sizeof(cl_uint),
+                                     slot.counts.data(), nullptr, &slot.read);
+            slot.counted = true;
+            queue_.flush();
+
+            slot.busy = true;
         }
+
+        carry = std::min(overlap, size);
+        tail = slot.host + size - carry;
     }
 
+    add_counts(slots[k % 2]);
+    add_counts(slots[(k + 1) % 2]);
+
+    return res;
+}
+
+std::vector<std::vector<size_t>> PatternMatchingGPU::MatchBatch(const std::vector<std::string_view>& texts,
+                                                                size_t& time) const {
+
+    std::vector<std::vector<size_t>> res(texts.size(), std::vector<size_t>(patterns_.size()));
+
+    for (const auto& hit : MatchBatchHits(texts, time))
+        res[hit.text][hit.pattern] = hit.count;
+
     return res;
 }
 
+std::vector<PatternMatchingGPU::Hit> PatternMatchingGPU::MatchBatchHits(const std::vector<std::string_view>& texts,
+                                                                        size_t& time) const {
 
-void PatternMatchingGPU::BuildPatternTable() {
+    if (options_.verification != Verification::Device)
+        throw std::logic_error("Batch matching requires device verification");
 
-    int num = 0;
-    for (const auto & p : patterns_)
-    {
-        if (p.size() > 5) {
-            auto i = static_cast<u_char>(p[0]);
-            auto j = static_cast<u_char>(p[1]);
-            Pattern_table.at(i, j).push_back(num);
-            maxdepth = std::max(maxdepth, Pattern_table.at(i,j).size());
+    size_t size = 0;
+    for (const auto& text : texts)
+        size += text.size();
+
+    if (size >= std::numeric_limits<cl_uint>::max() || texts.size() >= std::numeric_limits<cl_uint>::max())
+        throw std::length_error("Batch is too long for 32-bit positions");
+
+    std::vector<Hit> hits;
+
+    time = 0;
+    if (!size)
+        return hits;
+
+    std::lock_guard lock(session_mutex_);
+
+    // a work-item takes two positions, as in the other kernels
+    const size_t groups_count = (size / 2 + size % 2 + work_group_size_ - 1) / work_group_size_;
+    ReserveBatch(size, texts.size(), groups_count);
+
+    // texts go to the device in one write
+    for (size_t k = 0, at = 0; k < texts.size(); ++k) {
+        batch_offsets_[k] = static_cast<cl_uint>(at);
+        std::memcpy(batch_text_.data() + at, texts[k].data(), texts[k].size());
+        at += texts[k].size();
+    }
+    batch_offsets_[texts.size()] = static_cast<cl_uint>(size);
+
+    queue_.enqueueWriteBuffer(batch_buffer_, CL_FALSE, 0, size, batch_text_.data());
+    queue_.enqueueWriteBuffer(batch_offsets_buffer_, CL_FALSE, 0, (texts.size() + 1) * sizeof(cl_uint), batch_offsets_.data());
+
+    auto start_time = std::chrono::system_clock::now();
+
+    // the short patterns' entries go first, the longer ones' are appended to them
+    cl_uint entries = 0;
+    if (short_kernel_())
+        entries = CountBatch(true, size, texts.size(), groups_count, entries);
+    if (maxdepth)
+        entries = CountBatch(false, size, texts.size(), groups_count, entries);
+
+    hits_.resize(entries * 3);
+    if (entries)
+        queue_.enqueueReadBuffer(hits_buffer_, CL_TRUE, 0, hits_.size() * sizeof(cl_uint), hits_.data());
+
+    auto finish_time = std::chrono::system_clock::now();
+    time = (finish_time - start_time).count();
+
+    // entries come in no particular order, a pair matched by several work-groups has several
+    std::vector<Hit> read(entries);
+    for (size_t i = 0; i < read.size(); ++i)
+        read[i] = {hits_[i * 3], hits_[i * 3 + 1], hits_[i * 3 + 2]};
+
+    std::sort(read.begin(), read.end(), [](const Hit& a, const Hit& b) {
+        return std::tie(a.text, a.pattern) < std::tie(b.text, b.pattern);
+    });
+
+    for (const auto& entry : read) {
+        if (!hits.empty() && hits.back().text == entry.text && hits.back().pattern == entry.pattern)
+            hits.back().count += entry.count;
+        else
+            hits.push_back(entry);
+    }
+
+    if (!short_duplicates_.empty()) {
+        CopyDuplicates(short_duplicates_, hits);
+        std::sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) {
+            return std::tie(a.text, a.pattern) < std::tie(b.text, b.pattern);
+        });
+    }
+
+    return hits;
+}
+
+cl_uint PatternMatchingGPU::CountBatch(bool short_patterns, size_t size, size_t texts_count, size_t groups_count,
+                                       cl_uint entries) const {
+
+    // work-groups whose entries didn't fit run again with room for them, the others keep what they wrote
+    cl_uint counters[2] = {entries, 0}; // (entries, missed work-groups)
+    size_t launched = groups_count;
+    bool listed = false;
+
+    for (;;) {
+        queue_.enqueueWriteBuffer(batch_counters_buffer_, CL_FALSE, 0, sizeof(counters), counters);
+        EnqueueBatch(short_patterns, size, texts_count, launched, listed);
+        queue_.enqueueReadBuffer(batch_counters_buffer_, CL_TRUE, 0, sizeof(counters), counters);
+
+        if (!counters[1])
+            break;
+
+        missed_groups_.resize(counters[1] * 2);
+        queue_.enqueueReadBuffer(missed_groups_buffer_, CL_TRUE, 0, missed_groups_.size() * sizeof(cl_uint),
+                                 missed_groups_.data());
+
+        size_t needed = counters[0];
+        for (size_t i = 0; i < counters[1]; ++i) {
+            listed_groups_[i] = missed_groups_[i * 2];
+            needed += missed_groups_[i * 2 + 1];
         }
-        ++num;
+
+        if (needed > std::numeric_limits<cl_uint>::max())
+            throw std::length_error("Batch has too many hits for 32-bit places");
+
+        // the buffer grows twice at a time, the entries written so far are copied there
+        if (needed > hits_capacity_) {
+            const size_t capacity = std::min<size_t>(std::max(needed, hits_capacity_ * 2), std::numeric_limits<cl_uint>::max());
+
+            cl::Buffer grown(context_, CL_MEM_WRITE_ONLY, capacity * 3 * sizeof(cl_uint));
+            if (counters[0])
+                queue_.enqueueCopyBuffer(hits_buffer_, grown, 0, 0, counters[0] * 3 * sizeof(cl_uint));
+            hits_buffer_ = grown;
+            hits_capacity_ = capacity;
+        }
+
+        queue_.enqueueWriteBuffer(listed_groups_buffer_, CL_FALSE, 0, counters[1] * sizeof(cl_uint), listed_groups_.data());
+        launched = counters[1];
+        listed = true;
+        counters[1] = 0;
     }
 
+    return counters[0];
+}
+
+void PatternMatchingGPU::ReserveBatch(size_t size, size_t texts_count, size_t groups_count) const {
+
+    if (!batch_kernel_())
+        batch_kernel_ = cl::Kernel(program_, options_.index == Index::Hash ? "batch_hash_count" : "batch_signature_count");
+
+    if (short_kernel_() && !batch_short_kernel_())
+        batch_short_kernel_ = cl::Kernel(program_, "batch_short_count");
+
+    if (size > batch_capacity_) {
+        batch_capacity_ = size;
+        batch_text_.resize(batch_capacity_);
+        batch_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY, batch_capacity_);
+    }
+
+    if (texts_count > batch_texts_capacity_) {
+        batch_texts_capacity_ = texts_count;
+        batch_offsets_.resize(batch_texts_capacity_ + 1);
+        batch_offsets_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY, (batch_texts_capacity_ + 1) * sizeof(cl_uint));
+    }
+
+    // every work-group is missed at most once a launch
+    if (groups_count > batch_groups_capacity_) {
+        batch_groups_capacity_ = groups_count;
+        listed_groups_.resize(batch_groups_capacity_);
+        missed_groups_buffer_ = cl::Buffer(context_, CL_MEM_READ_WRITE, batch_groups_capacity_ * 2 * sizeof(cl_uint));
+        listed_groups_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY, batch_groups_capacity_ * sizeof(cl_uint));
+    }
+
+    if (!hits_capacity_) {
+        hits_capacity_ = 1 << 16;
+        hits_buffer_ = cl::Buffer(context_, CL_MEM_WRITE_ONLY, hits_capacity_ * 3 * sizeof(cl_uint));
+        batch_counters_buffer_ = cl::Buffer(context_, CL_MEM_READ_WRITE, 2 * sizeof(cl_uint));
+    }
+}
+
+void PatternMatchingGPU::EnqueueBatch(bool short_patterns, size_t size, size_t texts_count, size_t groups_count,
+                                      bool listed) const {
+
+    auto& kernel = short_patterns ? batch_short_kernel_ : batch_kernel_;
+
+    kernel.setArg(0, batch_buffer_);
+    kernel.setArg(1, static_cast<cl_uint>(size));
+    kernel.setArg(2, batch_offsets_buffer_);
+    kernel.setArg(3, static_cast<cl_uint>(texts_count));
+
+    cl_uint arg = 4;
+    if (short_patterns) {
+        kernel.setArg(arg++, short_direct_buffer_);
+        kernel.setArg(arg++, short_prefixes_buffer_);
+        kernel.setArg(arg++, short_slots_buffer_);
+        kernel.setArg(arg++, short_slots_mask_);
+        kernel.setArg(arg++, short_probes_);
+        kernel.setArg(arg++, short_lengths_);
+    } else {
+        if (options_.index == Index::Hash) {
+            kernel.setArg(arg++, slots_buffer_);
+            kernel.setArg(arg++, static_cast<cl_uint>(database_->GetHashBucketsCount() - 1));
+            kernel.setArg(arg++, static_cast<cl_ulong>(database_->GetHashSeed()));
+            kernel.setArg(arg++, group_offsets_buffer_);
+            kernel.setArg(arg++, group_patterns_buffer_);
+        } else {
+            kernel.setArg(arg++, bucket_offsets_buffer_);
+            kernel.setArg(arg++, entries_buffer_);
+        }
+
+        kernel.setArg(arg++, patterns_buffer_);
+        kernel.setArg(arg++, pattern_offsets_buffer_);
+    }
+
+    kernel.setArg(arg++, static_cast<cl_uint>(patterns_.size()));
+    kernel.setArg(arg++, listed_groups_buffer_);
+    kernel.setArg(arg++, static_cast<cl_uint>(listed));
+    kernel.setArg(arg++, hits_buffer_);
+    kernel.setArg(arg++, batch_counters_buffer_);
+    kernel.setArg(arg++, missed_groups_buffer_);
+    kernel.setArg(arg++, static_cast<cl_uint>(hits_capacity_));
+
+    // two counters a work-item, and the work-group's range of hits
+    kernel.setArg(arg++, cl::Local(2 * work_group_size_ * sizeof(cl_uint)));
+    kernel.setArg(arg++, cl::Local(2 * work_group_size_ * sizeof(cl_uint)));
+    kernel.setArg(arg++, cl::Local(2 * sizeof(cl_uint)));
+
+    // signature tables of every depth are looked up in the one launch, the bucket of each cell at once
+    queue_.enqueueNDRangeKernel(kernel, cl::NDRange(0), cl::NDRange(groups_count * work_group_size_),
+                                cl::NDRange(work_group_size_));
+}
+
+void PatternMatchingGPU::MatchOnHost(const cl::Buffer& text_buffer, size_t text_offset, std::string_view text,
+                                     size_t limit, std::vector<size_t>& res) const {
+
+    // only positions before the limit are looked up and read back
+    const cl::NDRange global_size(limit / 2 + limit % 2);
+
+    kernel_.setArg(0, text_buffer);
+    kernel_.setArg(1, static_cast<cl_uint>(text_offset));
+    kernel_.setArg(2, static_cast<cl_uint>(text.size()));
+
+    answers_.resize(limit);
+
     if (!maxdepth)
-        throw std::invalid_argument("Count of patterns = 0");
+        return;
+
+    if (options_.index == Index::Hash) {
+        kernel_.setArg(3, answer_buffers_[0]);
+        kernel_.setArg(4, slots_buffer_);
+        kernel_.setArg(5, static_cast<cl_uint>(database_->GetHashBucketsCount() - 1));
+        kernel_.setArg(6, static_cast<cl_ulong>(database_->GetHashSeed()));
+
+        queue_.enqueueNDRangeKernel(kernel_, cl::NDRange(0), global_size, cl::NullRange, nullptr, Profile("match"));
+        queue_.enqueueReadBuffer(answer_buffers_[0], CL_TRUE, 0, answers_.size() * sizeof(cl_uint), answers_.data(),
+                                 nullptr, Profile("read answers"));
+
+        const auto begin = std::chrono::steady_clock::now();
+        CheckGroups(text, answers_, res);
+        if (timing_)
+            timing_->verification += std::chrono::nanoseconds(std::chrono::steady_clock::now() - begin).count();
+        return;
+    }
+
+    std::vector<cl::Event> events(maxdepth);
+
+    kernel_.setArg(4, bucket_offsets_buffer_);
+    kernel_.setArg(5, entries_buffer_);
+
+    cl::NDRange tables_size = global_size;
+    cl::NDRange local_size = cl::NullRange;
+    if (options_.positions_per_item) {
+        kernel_.setArg(7, static_cast<cl_uint>(limit));
+        kernel_.setArg(8, static_cast<cl_uint>(options_.positions_per_item));
+        kernel_.setArg(9, cl::Local(GetTileSize()));
+        tables_size = GetTiledRange(limit);
+        local_size = cl::NDRange(work_group_size_);
+    }
+
+    for(std::size_t i = 0; i < maxdepth; ++i) {
+
+        kernel_.setArg(3, answer_buffers_[i]);
+        kernel_.setArg(6, static_cast<cl_uint>(i));
+
+        queue_.enqueueNDRangeKernel(kernel_,  cl::NDRange(0), tables_size, local_size, nullptr, &events.at(i));
+        Profile(events[i], "match", i);
+    }
+
+    // answer[n] is entry + 1 of the table's pattern that can start from text[n], 0 if there is none
+    for(std::size_t step = 0; step < maxdepth; ++step) {
+
+        events[step].wait();
+        queue_.enqueueReadBuffer(answer_buffers_[step], CL_TRUE, 0, answers_.size() * sizeof(cl_uint), answers_.data(),
+                                 nullptr, Profile("read answers", step));
+
+        const auto begin = std::chrono::steady_clock::now();
+        CheckAnswers(text, answers_, res);
+        if (timing_)
+            timing_->verification += std::chrono::nanoseconds(std::chrono::steady_clock::now() - begin).count();
+    }
+}
+
+cl::NDRange PatternMatchingGPU::GetTiledRange(size_t limit) const {
+
+    const size_t items = (limit + options_.positions_per_item - 1) / options_.positions_per_item;
+    return cl::NDRange((items + work_group_size_ - 1) / work_group_size_ * work_group_size_);
+}
+
+size_t PatternMatchingGPU::GetTileSize() const {
+
+    // tile_size in gpu/match.cl: the work-group's positions and the 5 bytes after them, in whole vload16 chunks
+    return (work_group_size_ * options_.positions_per_item + 5 + 15) / 16 * 16;
+}
+
+void PatternMatchingGPU::ReserveBuffers(size_t size) const {
+
+    if (size <= buffers_capacity_)
+        return;
+
+    // work-items handle two positions each, so the answers are written up to an even size
+    buffers_capacity_ = size + size % 2;
+
+    // unified devices read texts in place, unless one has been refused
+    if (!host_unified_memory_ || text_refused_)
+        text_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY, buffers_capacity_ * sizeof(std::char_traits<char>));
+
+    if (options_.verification == Verification::Device)
+        return;
+
+    // the hashed index answers every position in one buffer
+    answer_buffers_.resize(options_.index == Index::Hash ? 1 : maxdepth);
+    for (auto& buf : answer_buffers_)
+        buf = cl::Buffer(context_, CL_MEM_WRITE_ONLY, buffers_capacity_ * sizeof(cl_uint));
 }
 
-void PatternMatchingGPU::BuildSignatureTables() {
+void PatternMatchingGPU::CheckAnswers
+    (std::string_view text, const std::vector<cl_uint>& answers, std::vector<size_t>& res) const {
+
+    Verify(answers.size(), [&](size_t begin, size_t end, WorkerCounts& acc) {
+        for (size_t n = NextAnswer(answers.data(), begin, end); n < end; n = NextAnswer(answers.data(), n + 1, end)) {
+            const size_t pattern_idx = entries_[(answers[n] - 1) * 2 + 1] - 1;
+            const auto& pat = patterns_[pattern_idx];
+            const auto& tail = tails_[pattern_idx];
 
-    std::vector<linal::Matrix<cl_float4>> tables(maxdepth);
-    for (int k = 0; k < maxdepth; ++k)
-        tables[k].resize(SignatureTables::n_, SignatureTables::n_);
+            // the first 6 bytes are the signature the kernel has matched, the next 8 are one word compare,
+            // which settles most false signatures and every pattern of up to 14 bytes
+            if (n + pat.size() > text.size() || (LoadTail(text, n) & tail.mask) != tail.word)
+                continue;
+
+            if (pat.size() <= 14 || !std::memcmp(text.data() + n + 14, pat.data() + 14, pat.size() - 14))
+                acc.Add(pattern_idx);
+        }
+    }, res);
+}
 
-    for (size_t i = 0; i < SignatureTables::n_; ++i) {
-        for (size_t j = 0; j < SignatureTables::n_; ++j) {
-            auto&& patterns = Pattern_table.at(i, j);
+void PatternMatchingGPU::CheckGroups
+    (std::string_view text, const std::vector<cl_uint>& answers, std::vector<size_t>& res) const {
 
-            for (int k = 0; k < maxdepth; ++k) {
+    const cl_uint* offsets = database_->GetGroupOffsets();
 
-                if (patterns.size() > k) {
+    Verify(answers.size(), [&](size_t begin, size_t end, WorkerCounts& acc) {
+        for (size_t n = NextAnswer(answers.data(), begin, end); n < end; n = NextAnswer(answers.data(), n + 1, end)) {
+            const size_t group = answers[n] - 1;
+            const char* at = text.data() + n;
+            const size_t rest = text.size() - n;
 
-                    const size_t n = patterns[k];
-                    auto&& pat = patterns_[n];
+            // patterns of the group go sorted, so the text's common prefix with the previous one tells how much of
+            // the next one is matched: it fails where the previous one did, or is compared from their common prefix
+            size_t matched = 6; // the 6-byte prefix is the group's key
+            for (size_t k = offsets[group]; k < offsets[group + 1]; ++k) {
+                const auto& pat = patterns_[group_order_[k]];
+                const size_t common = group_common_[k];
 
-                    if (pat.size() > 5) {
-                        tables[k].at(i, j).x = pat.at(2);
-                        tables[k].at(i, j).y = pat.at(3);
-                        tables[k].at(i, j).z = pat.at(4);
-                        tables[k].at(i, j).w = pat.at(5);
-                    }
+                if (matched < common)
+                    continue;
+
+                if (matched > common) {
+                    matched = common;
+                } else {
+                    const size_t size = std::min(rest, pat.size());
+                    matched = common + CommonPrefix(at + common, pat.data() + common, size - common);
                 }
+
+                if (matched == pat.size())
+                    acc.Add(group_order_[k]);
             }
         }
+    }, res);
+}
+
+void PatternMatchingGPU::ComputeTails() {
+
+    for (size_t i = tails_.size(); i < patterns_.size(); ++i) {
+        const auto& pat = patterns_[i];
+        const size_t size = pat.size() > 6 ? std::min<size_t>(pat.size() - 6, 8) : 0;
+
+        Tail tail;
+        std::memcpy(&tail.word, pat.data() + 6, size);
+        std::memset(&tail.mask, 0xFF, size);
+        tails_.push_back(tail);
     }
+}
 
-    signatures_.tables_ = tables;
+void PatternMatchingGPU::SortGroups() {
+
+    const auto offsets = database_->GetGroupOffsets();
+    const auto groups_count = database_->GetGroupsCount();
+    const auto patterns = database_->GetGroupPatterns();
+
+    group_order_.assign(patterns, patterns + offsets[groups_count]);
+    group_common_.assign(group_order_.size(), 6);
+
+    for (size_t group = 0; group < groups_count; ++group) {
+        const auto first = group_order_.begin() + offsets[group];
+        const auto last = group_order_.begin() + offsets[group + 1];
+        std::sort(first, last, [&](cl_uint a, cl_uint b) { return patterns_[a] < patterns_[b]; });
+
+        for (size_t k = offsets[group] + 1; k < offsets[group + 1]; ++k) {
+            const auto& prev = patterns_[group_order_[k - 1]];
+            const auto& pat = patterns_[group_order_[k]];
+            group_common_[k] = static_cast<cl_uint>(CommonPrefix(prev.data(), pat.data(), std::min(prev.size(), pat.size())));
+        }
+    }
 }
 
+void PatternMatchingGPU::Verify(size_t size, const std::function<void(size_t, size_t, WorkerCounts&)>& verify,
+                                std::vector<size_t>& res) const {
 
-/*void PatternMatchingGPU::BuildSignatureTables() {
+    const size_t workers = pool_ ? pool_->GetThreadsCount() : 1;
 
-    Signature_tables.resize(maxdepth);
+    worker_counts_.resize(workers);
+    for (auto& acc : worker_counts_)
+        acc.counts.resize(patterns_.size());
 
-    for (size_t i = 0; i < SignatureTable::n_; ++i) {
-        for (size_t j = 0; j < SignatureTable::n_; ++j) {
-            auto&& patterns = Pattern_table.at(i, j);
+    // a few chunks per worker, so that stealing evens out the candidates, which are rarely spread evenly
+    const size_t chunk_size = std::max(min_verify_chunk_, size / (workers * 4) + 1);
+    const size_t chunks = (size + chunk_size - 1) / chunk_size;
 
-            for (int k = 0; k < maxdepth; ++k) {
+    if (chunks > 1 && pool_) {
+        pool_->Run(chunks, [&](size_t chunk, size_t worker) {
+            const size_t begin = chunk * chunk_size;
+            verify(begin, std::min(begin + chunk_size, size), worker_counts_[worker]);
+        });
+    } else {
+        verify(0, size, worker_counts_[0]);
+    }
 
-                if (patterns.size() > k) {
+    for (auto& acc : worker_counts_) {
+        for (const auto idx : acc.touched) {
+            res[idx] += acc.counts[idx];
+            acc.counts[idx] = 0;
+        }
+        acc.touched.clear();
+    }
+}
 
-                    const size_t n = patterns[k];
-                    auto&& pat = patterns_[n];
+std::vector<size_t> PatternMatchingGPU::FindSmallPatterns(std::string_view text, size_t limit) const {
 
-                    if (pat.size() > 5) {
-                        Signature_tables[k].at(i, j).x = pat.at(2);
-                        Signature_tables[k].at(i, j).y = pat.at(3);
-                        Signature_tables[k].at(i, j).z = pat.at(4);
-                        Signature_tables[k].at(i, j).w = pat.at(5);
-                    }
-                }
+    std::vector<size_t> res(patterns_.size());
+    short_patterns_.Count(text, limit, res);
+
+    return res;
+}
+
+
+void PatternMatchingGPU::UploadSignatureTables() {
+
+    // the tables go to the device as the database has them: the offsets of the cells and 8 bytes per pattern
+    const cl_uint* offsets = database_->GetBucketOffsets();
+    const cl_uint* entries = database_->GetBucketEntries();
+
+    bucket_offsets_.assign(offsets, offsets + PatternDatabase::cells_count + 1);
+    entries_.assign(entries, entries + bucket_offsets_.back() * 2);
+
+    bucket_offsets_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        bucket_offsets_.size() * sizeof(cl_uint), bucket_offsets_.data());
+
+    // an empty buffer isn't valid, the kernels never read the entry of a set without signature patterns
+    entries_capacity_ = std::max<size_t>(entries_.size() / 2, 1);
+    entries_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY, entries_capacity_ * 2 * sizeof(cl_uint));
+    if (!entries_.empty())
+        queue_.enqueueWriteBuffer(entries_buffer_, CL_TRUE, 0, entries_.size() * sizeof(cl_uint), entries_.data());
+}
+
+void PatternMatchingGPU::UploadHashIndex() {
+
+    const size_t slots_size = database_->GetHashBucketsCount() * PatternDatabase::bucket_slots * 4 * sizeof(cl_uint);
+    const size_t offsets_size = (database_->GetGroupsCount() + 1) * sizeof(cl_uint);
+    const size_t patterns_size = database_->GetGroupOffsets()[database_->GetGroupsCount()] * sizeof(cl_uint);
+
+    slots_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, slots_size,
+                               const_cast<cl_uint*>(database_->GetHashSlots()));
+    group_offsets_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, offsets_size,
+                                       const_cast<cl_uint*>(database_->GetGroupOffsets()));
+    group_patterns_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, patterns_size,
+                                        const_cast<cl_uint*>(database_->GetGroupPatterns()));
+}
+
+void PatternMatchingGPU::UploadPatterns() {
+
+    const auto bytes = database_->GetPatternBytes();
+    const size_t offsets_size = (database_->GetPatternsCount() + 1) * sizeof(cl_uint);
+
+    patterns_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes.size(),
+                                  const_cast<char*>(bytes.data()));
+    pattern_offsets_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, offsets_size,
+                                         const_cast<cl_uint*>(database_->GetPatternOffsets()));
+    counts_buffer_ = cl::Buffer(context_, CL_MEM_READ_WRITE, patterns_.size() * sizeof(cl_uint));
+
+    pattern_bytes_capacity_ = bytes.size();
+    patterns_capacity_ = patterns_.size();
+}
+
+std::vector<size_t> PatternMatchingGPU::AddPatterns(const std::vector<std::string>& patterns) {
+
+    if (options_.index != Index::Table)
+        throw std::logic_error("Pattern updates require the table index");
+
+    size_t bytes_count = pattern_offsets_.back();
+    for (const auto& pat : patterns)
+        bytes_count += pat.size();
+
+    if (patterns_.size() + patterns.size() >= std::numeric_limits<cl_uint>::max())
+        throw std::length_error("Too many patterns for 32-bit ids");
+    if (bytes_count > std::numeric_limits<cl_uint>::max())
+        throw std::length_error("Patterns are too long for 32-bit offsets");
+
+    std::lock_guard lock(session_mutex_);
+
+    const size_t first = patterns_.size();
+    const size_t depth = maxdepth;
+
+    std::vector<size_t> ids;
+    std::vector<std::pair<size_t, size_t>> added; // (cell, id) of the patterns with a signature
+    bool short_added = false;
+
+    for (const auto& pat : patterns) {
+        const size_t n = patterns_.size();
+        patterns_.push_back(pat);
+        removed_.push_back(false);
+        ids.push_back(n);
+        max_length_ = std::max(max_length_, pat.size());
+
+        if (pat.size() <= 5) {
+            short_added = short_added || !pat.empty();
+            continue;
+        }
+
+        added.push_back({static_cast<unsigned char>(pat[0]) << 8 | static_cast<unsigned char>(pat[1]), n});
+    }
+
+    // a pattern takes the first empty entry of its cell, the cells without enough of them grow first
+    std::sort(added.begin(), added.end());
+
+    std::vector<std::pair<size_t, size_t>> grown;
+    for (size_t i = 0, j = 0; i < added.size(); i = j) {
+        const size_t cell = added[i].first;
+        while (j < added.size() && added[j].first == cell)
+            ++j;
+
+        size_t empty = 0;
+        for (size_t at = bucket_offsets_[cell]; at < bucket_offsets_[cell + 1]; ++at)
+            empty += !entries_[at * 2 + 1];
+        if (j - i > empty)
+            grown.push_back({cell, j - i - empty});
+    }
+
+    const size_t first_moved = grown.empty() ? PatternDatabase::cells_count : grown.front().first;
+    GrowCells(grown);
+
+    std::vector<size_t> entries;
+    for (const auto& [cell, n] : added) {
+        size_t at = bucket_offsets_[cell];
+        while (entries_[at * 2 + 1])
+            ++at;
+
+        entries_[at * 2] = PatternDatabase::PackTag(patterns_[n]);
+        entries_[at * 2 + 1] = static_cast<cl_uint>(n + 1);
+        entries.push_back(at);
+
+        // the entry's depth is the table it is matched by
+        maxdepth = std::max<size_t>(maxdepth, at - bucket_offsets_[cell] + 1);
+    }
+
+    UpdateTableEntries(entries, first_moved);
+
+    // grown tables also need one pooled answers buffer more
+    if (maxdepth != depth)
+        buffers_capacity_ = 0;
+
+    AppendPatterns(first);
+
+    if (options_.verification == Verification::Host)
+        ComputeTails();
+
+    if (short_added)
+        RebuildShortPatterns();
+
+    return ids;
+}
+
+void PatternMatchingGPU::RemovePatterns(const std::vector<size_t>& ids) {
+
+    if (options_.index != Index::Table)
+        throw std::logic_error("Pattern updates require the table index");
+
+    std::lock_guard lock(session_mutex_);
+
+    for (const auto id : ids)
+        if (id >= patterns_.size())
+            throw std::out_of_range("No pattern with id " + std::to_string(id));
+
+    std::vector<size_t> entries;
+    bool short_removed = false;
+
+    for (const auto id : ids) {
+        if (removed_[id])
+            continue;
+        removed_[id] = true;
+
+        const auto& pat = patterns_[id];
+        if (pat.size() <= 5) {
+            short_removed = short_removed || !pat.empty();
+            continue;
+        }
+
+        // the entry is cleared and left for the next pattern added to the cell
+        const size_t cell = static_cast<unsigned char>(pat[0]) << 8 | static_cast<unsigned char>(pat[1]);
+        for (size_t at = bucket_offsets_[cell]; at < bucket_offsets_[cell + 1]; ++at) {
+            if (entries_[at * 2 + 1] == id + 1) {
+                entries_[at * 2] = 0;
+                entries_[at * 2 + 1] = 0;
+                entries.push_back(at);
+                break;
             }
         }
     }
 
-}*/
+    UpdateTableEntries(entries);
+
+    if (short_removed)
+        RebuildShortPatterns();
+}
+
+void PatternMatchingGPU::GrowCells(const std::vector<std::pair<size_t, size_t>>& cells) {
+
+    if (cells.empty())
+        return;
+
+    // a cell at least doubles, so it is grown only a few times; the cells after the first grown one move
+    const size_t first = cells.front().first;
+    std::vector<cl_uint> offsets(bucket_offsets_);
+
+    size_t total = offsets[first];
+    for (size_t cell = first, i = 0; cell < PatternDatabase::cells_count; ++cell) {
+        size_t size = bucket_offsets_[cell + 1] - bucket_offsets_[cell];
+        if (i < cells.size() && cells[i].first == cell)
+            size += std::max(cells[i++].second, size);
+
+        total += size;
+        if (total > std::numeric_limits<cl_uint>::max())
+            throw std::length_error("Too many signature entries for 32-bit offsets");
+        offsets[cell + 1] = static_cast<cl_uint>(total);
+    }
+
+    // the entries move to the end from the last cell on, the added room is empty
+    entries_.resize(total * 2);
+    for (size_t cell = PatternDatabase::cells_count; cell-- > first;) {
+        const size_t size = bucket_offsets_[cell + 1] - bucket_offsets_[cell];
+        std::copy_backward(entries_.begin() + bucket_offsets_[cell] * 2, entries_.begin() + bucket_offsets_[cell + 1] * 2,
+                           entries_.begin() + (offsets[cell] + size) * 2);
+        std::fill(entries_.begin() + (offsets[cell] + size) * 2, entries_.begin() + offsets[cell + 1] * 2, 0);
+    }
+
+    bucket_offsets_ = std::move(offsets);
+}
+
+void PatternMatchingGPU::UpdateTableEntries(const std::vector<size_t>& entries, size_t first_moved) {
+
+    const size_t cells_count = PatternDatabase::cells_count;
+    if (entries.empty() && first_moved == cells_count)
+        return;
+
+    // entries before the first moved cell stay where the device has them
+    const size_t moved_from = bucket_offsets_[first_moved];
+
+    // the buffer grows twice at a time, what the device already has in place is copied there
+    const size_t entries_count = entries_.size() / 2;
+    if (entries_count > entries_capacity_) {
+        const size_t capacity = std::max(entries_count, entries_capacity_ * 2);
+
+        cl::Buffer grown(context_, CL_MEM_READ_ONLY, capacity * 2 * sizeof(cl_uint));
+        if (moved_from)
+            queue_.enqueueCopyBuffer(entries_buffer_, grown, 0, 0, moved_from * 2 * sizeof(cl_uint));
+        entries_buffer_ = grown;
+        entries_capacity_ = capacity;
+    }
+
+    for (const auto entry : entries)
+        if (entry < moved_from)
+            queue_.enqueueWriteBuffer(entries_buffer_, CL_FALSE, entry * 2 * sizeof(cl_uint), 2 * sizeof(cl_uint),
+                                      entries_.data() + entry * 2);
+
+    if (first_moved < cells_count) {
+        queue_.enqueueWriteBuffer(bucket_offsets_buffer_, CL_FALSE, (first_moved + 1) * sizeof(cl_uint),
+                                  (cells_count - first_moved) * sizeof(cl_uint), bucket_offsets_.data() + first_moved + 1);
+        if (entries_count > moved_from)
+            queue_.enqueueWriteBuffer(entries_buffer_, CL_FALSE, moved_from * 2 * sizeof(cl_uint),
+                                      (entries_count - moved_from) * 2 * sizeof(cl_uint), entries_.data() + moved_from * 2);
+    }
 
+    // the writes read the host copies, which the next update may move
+    queue_.finish();
+}
+
+void PatternMatchingGPU::AppendPatterns(size_t first) {
+
+    const size_t old_bytes = pattern_offsets_[first];
+    for (size_t n = first; n < patterns_.size(); ++n)
+        pattern_offsets_.push_back(static_cast<cl_uint>(pattern_offsets_[n] + patterns_[n].size()));
 
+    if (options_.verification != Verification::Device)
+        return;
+
+    // buffers grow twice at a time, the bytes already on the device are copied there
+    const size_t bytes_count = pattern_offsets_.back();
+    if (bytes_count > pattern_bytes_capacity_) {
+        pattern_bytes_capacity_ = std::max(bytes_count, pattern_bytes_capacity_ * 2);
+
+        cl::Buffer grown(context_, CL_MEM_READ_ONLY, pattern_bytes_capacity_);
+        if (old_bytes)
+            queue_.enqueueCopyBuffer(patterns_buffer_, grown, 0, 0, old_bytes);
+        patterns_buffer_ = grown;
+    }
+
+    std::string bytes;
+    bytes.reserve(bytes_count - old_bytes);
+    for (size_t n = first; n < patterns_.size(); ++n)
+        bytes += patterns_[n];
+
+    if (!bytes.empty())
+        queue_.enqueueWriteBuffer(patterns_buffer_, CL_FALSE, old_bytes, bytes.size(), bytes.data());
+
+    // offsets are few, so grown buffers just get all of them again
+    if (patterns_.size() > patterns_capacity_) {
+        patterns_capacity_ = std::max(patterns_.size(), patterns_capacity_ * 2);
+        pattern_offsets_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY, (patterns_capacity_ + 1) * sizeof(cl_uint));
+        counts_buffer_ = cl::Buffer(context_, CL_MEM_READ_WRITE, patterns_capacity_ * sizeof(cl_uint));
+        first = 0;
+    }
+
+    queue_.enqueueWriteBuffer(pattern_offsets_buffer_, CL_FALSE, first * sizeof(cl_uint),
+                              (pattern_offsets_.size() - first) * sizeof(cl_uint), pattern_offsets_.data() + first);
+    queue_.finish();
+}
+
+void PatternMatchingGPU::RebuildShortPatterns() {
+
+    // removed patterns are passed as empty ones, which the matcher ignores
+    std::vector<std::string> active(patterns_.size());
+    short_ids_.clear();
+
+    for (size_t n = 0; n < patterns_.size(); ++n)
+        if (!removed_[n] && !patterns_[n].empty() && patterns_[n].size() <= 5) {
+            active[n] = patterns_[n];
+            short_ids_.push_back(n);
+        }
+
+    short_patterns_ = PackedMatcher(active, 5);
+
+    if (options_.verification == Verification::Device)
+        UploadShortTables();
+}
+
+void PatternMatchingGPU::UploadShortTables() {
+
+    std::vector<cl_uint> direct(256 + 65536);
+    std::vector<cl_uint> prefixes(65536 / 32);
+    std::vector<size_t> hashed;
+    std::unordered_map<std::string_view, size_t> counted;
+
+    short_duplicates_.clear();
+    short_lengths_ = 0;
+
+    for (const auto n : short_ids_) {
+        const std::string_view pat = patterns_[n];
+
+        const auto [it, first] = counted.emplace(pat, n);
+        if (!first) {
+            short_duplicates_.push_back({n, it->second});
+            continue;
+        }
+
+        const size_t cell = pat.size() > 1 ? static_cast<unsigned char>(pat[0]) << 8 | static_cast<unsigned char>(pat[1]) : 0;
+        if (pat.size() == 1) {
+            direct[static_cast<unsigned char>(pat[0])] = n + 1;
+        } else if (pat.size() == 2) {
+            direct[256 + cell] = n + 1;
+        } else {
+            prefixes[cell / 32] |= 1u << cell % 32;
+            short_lengths_ |= 1u << pat.size();
+            hashed.push_back(n);
+        }
+    }
+
+    if (short_ids_.empty()) {
+        short_kernel_ = cl::Kernel();
+        return;
+    }
+
+    // at most half full, so the probing stays short; keys are hashed as in find_short
+    size_t slots_count = 1;
+    while (slots_count < hashed.size() * 2)
+        slots_count *= 2;
+
+    std::vector<cl_uint> slots(slots_count * 4);
+    short_slots_mask_ = static_cast<cl_uint>(slots_count - 1);
+    short_probes_ = 0;
+
+    for (const auto n : hashed) {
+        const auto& pat = patterns_[n];
+
+        cl_uint lo = 0, hi = static_cast<cl_uint>(pat.size()) << 8;
+        for (size_t k = 0; k < pat.size(); ++k) {
+            if (k < 4)
+                lo |= static_cast<cl_uint>(static_cast<unsigned char>(pat[k])) << (k * 8);
+            else
+                hi |= static_cast<unsigned char>(pat[k]);
+        }
+
+        const uint64_t hash = (static_cast<uint64_t>(hi) << 32 | lo) * 0x9E3779B97F4A7C15ull;
+
+        cl_uint probes = 1;
+        size_t slot = (hash >> 32) & short_slots_mask_;
+        for (; slots[slot * 4 + 2]; slot = (slot + 1) & short_slots_mask_)
+            ++probes;
+
+        slots[slot * 4] = lo;
+        slots[slot * 4 + 1] = hi;
+        slots[slot * 4 + 2] = static_cast<cl_uint>(n + 1);
+        short_probes_ = std::max(short_probes_, probes);
+    }
+
+    short_direct_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, direct.size() * sizeof(cl_uint),
+                                      direct.data());
+    short_prefixes_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        prefixes.size() * sizeof(cl_uint), prefixes.data());
+    short_slots_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, slots.size() * sizeof(cl_uint),
+                                     slots.data());
+
+    if (!short_kernel_())
+        short_kernel_ = cl::Kernel(program_, "short_count");
+}
 
 void PatternMatchingGPU::ChoosePlatformAndDevice() {
 
@@ -288,7 +1645,7 @@ void PatternMatchingGPU::ChoosePlatformAndDevice() {
     device_ = all_devices[number][N];
 }
 
-void PatternMatchingGPU::ChooseDefaultPlatformAndDevice() {
+cl::Device PatternMatchingGPU::ChooseDefaultDevice() {
 
     std::vector<cl::Platform> platforms;
     cl::Platform::get(&platforms);
@@ -301,12 +1658,25 @@ void PatternMatchingGPU::ChooseDefaultPlatformAndDevice() {
 
         std::vector<cl::Device> devices;
         platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
-        if (!devices.empty()) {
-            platform_ = platform;
-            device_ = devices[0];
-            return;
-        }
+        if (!devices.empty())
+            return devices[0];
     }
 
     throw std::invalid_argument("No devices found");
+}
+
+std::vector<cl::Device> PatternMatchingGPU::GetDevices(cl_device_type type) {
+
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+
+    std::vector<cl::Device> all_devices;
+    for (auto &platform : platforms) {
+
+        std::vector<cl::Device> devices;
+        platform.getDevices(type, &devices);
+        all_devices.insert(all_devices.end(), devices.begin(), devices.end());
+    }
+
+    return all_devices;
 }
\ No newline at end of file
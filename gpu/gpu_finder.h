@@ -1,6 +1,9 @@
 #pragma once
 
-#include "Matrix/Matrix.h"
+#include "pattern_database.h"
+#include "program_cache.h"
+#include "../cpu/packed_matcher.h"
+#include "../cpu/thread_pool.h"
 
 #ifdef __APPLE__
 #include <OpenCL/cl.hpp>
@@ -8,52 +11,336 @@
 #include <CL/cl.hpp>
 #endif
 
+#include <deque>
 #include <sstream>
 #include <fstream>
+#include <functional>
+#include <iostream>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string_view>
 
 class PatternMatchingGPU final {
 
+public:
+
+    enum class Verification {
+        Device, // full patterns are checked and counted by the kernel, only counts are read back
+        Host    // kernel reports signature hits, CheckAnswers verifies them on the host
+    };
+
+    enum class Index {
+        Table, // one signature table per pattern sharing a cell, a kernel launch per table
+        Hash   // cuckoo table of 6-byte prefixes, one kernel launch whatever the depth
+    };
+
+    struct Options {
+        Verification verification = Verification::Device;
+        Index index = Index::Table;
+        std::filesystem::path program_cache = ProgramCache::GetDefaultDirectory(); // empty disables the cache
+        size_t threads = 0; // CPU threads of host verification, 0 means one per hardware thread
+        // consecutive positions of a work-item in the tiled signature kernels, which read the text through
+        // a local-memory tile; 0 keeps the two-position kernels. Only Index::Table has tiled kernels.
+        size_t positions_per_item = 0;
+    };
+
+    static constexpr size_t default_chunk_size = 1 << 24;
+
+    // count of one pattern in one text of a batch
+    struct Hit {
+        size_t text;
+        size_t pattern;
+        size_t count;
+    };
+
+    static constexpr size_t no_table = std::numeric_limits<size_t>::max();
+
+    // one command of the device queue, times in ns of the device clock (CL_QUEUE_PROFILING_ENABLE)
+    struct Stage {
+        std::string name;        // "upload text", "count", "read counts", "match", "read answers", ...
+        size_t table = no_table; // signature table of a per-table command
+        cl_ulong queued = 0;
+        cl_ulong submit = 0;
+        cl_ulong start = 0;
+        cl_ulong end = 0;
+    };
+
+    // where one Match call spent its time
+    struct Timing {
+        std::vector<Stage> stages; // ordered by queueing
+        size_t short_patterns = 0; // ns of matching the short patterns on the host, 0 when the device counts them
+        size_t verification = 0;   // ns of CheckAnswers or CheckGroups, with host verification
+        size_t total = 0;          // wall-clock ns of the device part, what the `time` overloads return
+    };
+
+    // start of one match
+    struct Position {
+        size_t pattern;
+        size_t offset;
+    };
+
 private:
 
     cl::Platform platform_;
     cl::Context context_;
     cl::Device device_;
     cl::CommandQueue queue_;
+    cl::CommandQueue transfer_queue_; // uploads of the next stream chunk overlap kernels on queue_
     cl::Program program_;
 
     const std::string kernel_name_;
+    const Options options_;
 
 private:
 
-    const std::vector<std::string> patterns_;
+    const std::shared_ptr<const PatternDatabase> database_; // bucket index and signature tables of the patterns
+    std::vector<std::string> patterns_; // by id, removed patterns stay in place
+    std::vector<bool> removed_;
+    size_t max_length_ = 0;
+
+    PackedMatcher short_patterns_; // patterns shorter than 6 bytes, matched on the host unless short_kernel_ is set
+    std::vector<size_t> short_ids_; // their indices
 
-    linal::Matrix<std::vector<size_t>> Pattern_table = linal::Matrix<std::vector<size_t>>(256,256);
     size_t maxdepth = 0;
 
-    struct SignatureTables final {
-        static constexpr unsigned n_ = 256; // number of rows and columns in matrix
+    // host copy of the signature tables, see gpu/match.cl: the bucket offsets of the database and the (tag, id)
+    // entries they index; the pattern updates leave room in the cells they grow, empty entries with id 0
+    std::vector<cl_uint> bucket_offsets_;
+    std::vector<cl_uint> entries_;
+    std::vector<cl_uint> pattern_offsets_;
+
+private:
+
+    // device state, built once in the constructor and reused by every Match call
+    cl::Buffer bucket_offsets_buffer_; // cells_count + 1 offsets of the cells into entries_buffer_
+    cl::Buffer entries_buffer_;        // (tag, id) of the signature tables of all depths
+    mutable cl::Kernel kernel_;
+
+    cl::Buffer slots_buffer_;           // PatternDatabase::GetHashSlots()
+    cl::Buffer group_offsets_buffer_;
+    cl::Buffer group_patterns_buffer_;
+    cl::Buffer patterns_buffer_;        // all pattern bytes back to back
+    cl::Buffer pattern_offsets_buffer_; // patterns_.size() + 1 offsets into patterns_buffer_
+    cl::Buffer counts_buffer_;
+    size_t patterns_capacity_ = 0;      // patterns the offsets and counts buffers can hold
+    size_t pattern_bytes_capacity_ = 0;
+    size_t entries_capacity_ = 0;       // entries entries_buffer_ can hold
+    mutable cl::Kernel count_kernel_;
+    size_t work_group_size_ = 64;
+
+    // the device reads host memory directly, so texts are wrapped with CL_MEM_USE_HOST_PTR instead of copied
+    bool host_unified_memory_ = false;
+    static constexpr size_t host_ptr_alignment_ = 4096;
+
+    mutable std::mutex session_mutex_;
+    mutable size_t buffers_capacity_ = 0; // text positions the pooled buffers can hold
+    mutable cl::Buffer text_buffer_;
+    mutable bool text_refused_ = false; // a unified device couldn't wrap a text, text_buffer_ is pooled from then on
+    mutable std::vector<cl::Buffer> answer_buffers_;
+    mutable std::vector<cl_uint> answers_;
+    mutable std::vector<cl_uint> counts_;      // the device counters as of their last read
+    mutable std::vector<cl_uint> read_counts_;
+    cl_uint counts_start_ = 0; // what ResetCounts sets the counters to; tests.cpp starts them near 2^32
+
+    // host verification runs on the pool, every worker counts into its own array
+    struct WorkerCounts {
+        std::vector<size_t> counts;
+        std::vector<size_t> touched; // patterns counted since the last merge, so the merge skips the rest
+
+        void Add(size_t idx) {
+            if (!counts[idx]++)
+                touched.push_back(idx);
+        }
+    };
+
+    // bytes [6, 14) of every pattern, with the mask of those it has, checked before the rest of the pattern
+    struct Tail {
+        uint64_t word = 0;
+        uint64_t mask = 0;
+    };
+    std::vector<Tail> tails_;
 
-        std::vector<linal::Matrix<cl_float4>> tables_;
+    // hashed index: the patterns of every group sorted, with the common prefix of each with the previous one
+    std::vector<cl_uint> group_order_;
+    std::vector<cl_uint> group_common_;
 
-        const cl_float4* GetData(size_t i) const {return tables_[i].data();};
+    std::unique_ptr<ThreadPool> pool_;
+    mutable std::vector<WorkerCounts> worker_counts_;
+    static constexpr size_t min_verify_chunk_ = 1 << 16;
 
-    } signatures_;
+    // device verification counts the short patterns with short_count over the same text, see gpu/match.cl,
+    // and finds their batch hits and positions with batch_short_count and short_positions; a pattern given
+    // twice is matched once on the device and its matches are copied to its duplicates
+    mutable cl::Kernel short_kernel_;
+    mutable cl::Kernel batch_short_kernel_;
+    mutable cl::Kernel short_positions_kernel_;
+    cl::Buffer short_direct_buffer_;   // 256 + 65536 ids of 1- and 2-byte patterns
+    cl::Buffer short_prefixes_buffer_; // 65536-bit bitmap of the first two bytes of 3-5 byte patterns
+    cl::Buffer short_slots_buffer_;
+    cl_uint short_slots_mask_ = 0;
+    cl_uint short_probes_ = 0;
+    cl_uint short_lengths_ = 0;
+    std::vector<std::pair<size_t, size_t>> short_duplicates_; // (id, id counted on the device)
+
+    // pooled batch state: texts packed back to back and the (text, pattern, count) entries of their matches,
+    // see gpu/match.cl; work-groups whose entries didn't fit are listed to run again
+    mutable cl::Kernel batch_kernel_;
+    mutable size_t batch_capacity_ = 0;        // bytes
+    mutable size_t batch_texts_capacity_ = 0;  // texts
+    mutable size_t batch_groups_capacity_ = 0; // work-groups
+    mutable size_t hits_capacity_ = 0;         // entries
+    mutable std::vector<char> batch_text_;
+    mutable std::vector<cl_uint> batch_offsets_;
+    mutable std::vector<cl_uint> hits_;
+    mutable std::vector<cl_uint> missed_groups_;
+    mutable std::vector<cl_uint> listed_groups_;
+    mutable cl::Buffer batch_buffer_;
+    mutable cl::Buffer batch_offsets_buffer_;
+    mutable cl::Buffer hits_buffer_;
+    mutable cl::Buffer batch_counters_buffer_; // (entries, missed work-groups)
+    mutable cl::Buffer missed_groups_buffer_;  // (work-group, entries) of the missed ones
+    mutable cl::Buffer listed_groups_buffer_;
+
+    // pooled positions state, (pattern, offset) pairs
+    mutable cl::Kernel positions_kernel_;
+    mutable size_t positions_capacity_ = 0;
+    mutable std::vector<cl_uint> positions_;
+    mutable cl::Buffer positions_buffer_;
+    mutable cl::Buffer positions_count_buffer_;
+
+    // profiling of the call in progress, commands are collected only while it is set
+    mutable Timing* timing_ = nullptr;
+    mutable std::deque<std::pair<Stage, cl::Event>> profiled_;
 
 private:
 
     void ChoosePlatformAndDevice(); //choose by user in console
-    void ChooseDefaultPlatformAndDevice(); //choose first suited platform and device
+    static cl::Device ChooseDefaultDevice(); //choose first GPU of the first platform that has one
+
+    void UploadSignatureTables();
+    void UploadHashIndex();
+    void UploadPatterns();
+
+    // gives the cells room for more entries, moving the entries of the cells after them
+    void GrowCells(const std::vector<std::pair<size_t, size_t>>& cells); // (cell, entries it needs room for)
+    // writes the changed entries to the device, and everything from the first moved cell on, see AddPatterns
+    void UpdateTableEntries(const std::vector<size_t>& entries, size_t first_moved = PatternDatabase::cells_count);
+    void AppendPatterns(size_t first);
+    void RebuildShortPatterns();
+    void UploadShortTables();
+
+    // event to pass to an enqueue when the call is profiled, nullptr otherwise
+    cl::Event* Profile(const char* name, size_t table = no_table) const;
+    void Profile(const cl::Event& event, const char* name, size_t table = no_table) const;
+    void CollectTiming() const;
+
+    void ReserveBuffers(size_t size) const;
+
+    // global range of the tiled kernels for positions [0, limit), and the bytes of their local tile
+    cl::NDRange GetTiledRange(size_t limit) const;
+    size_t GetTileSize() const;
+
+    void ComputeTails(); // of the patterns added since the last call
+    void SortGroups();
+
+    // verify(begin, end, counts) checks the candidates in [begin, end), in chunks across the pool
+    void Verify(size_t size, const std::function<void(size_t, size_t, WorkerCounts&)>& verify,
+                std::vector<size_t>& res) const;
+    // device buffer holding the text, wrapped in place when the device shares host memory
+    cl::Buffer UploadText(std::string_view text, size_t& text_offset) const;
 
-    void BuildPatternTable();
-    void BuildSignatureTables();
+    std::vector<size_t> FindSmallPatterns(std::string_view text, size_t limit) const;
 
-    std::vector<size_t> FindSmallPatterns(const std::string& text) const;
+    // text lies at text_offset of text_buffer, matches starting before limit are counted
+    void MatchOnHost(const cl::Buffer& text_buffer, size_t text_offset, std::string_view text, size_t limit,
+                     std::vector<size_t>& res) const;
+    void MatchOnDevice(const cl::Buffer& text_buffer, size_t text_offset, std::string_view text, size_t limit,
+                       std::vector<size_t>& res) const;
+
+    // device counting in three steps, so that several texts can be counted into the same counters
+    void ResetCounts() const;
+    void EnqueueCount(const cl::Buffer& text, size_t offset, size_t size, size_t limit,
+                      const std::vector<cl::Event>* wait = nullptr, cl::Event* done = nullptr) const;
+    void ReadCounts(std::vector<size_t>& res) const;
+    // adds what the counters have gained since their last read, counts is their new read
+    void AddCounts(const std::vector<cl_uint>& counts, std::vector<size_t>& res) const;
+
+    // starts the device counters just below 2^32, so that they wrap around
+    friend bool TestCountersWrap();
+
+    void ReserveBatch(size_t size, size_t texts_count, size_t groups_count) const;
+    // runs the short or the longer patterns' kernel over the batch until the entries of every work-group fit,
+    // appending them to the entries already in hits_buffer_; returns the entries there
+    cl_uint CountBatch(bool short_patterns, size_t size, size_t texts_count, size_t groups_count, cl_uint entries) const;
+    // runs groups_count work-groups of the batch, the first ones or, if listed, those of listed_groups_buffer_
+    void EnqueueBatch(bool short_patterns, size_t size, size_t texts_count, size_t groups_count, bool listed) const;
+
+    void ReservePositions(size_t capacity) const;
+    void EnqueuePositions(const cl::Buffer& text, size_t offset, size_t size, size_t capacity) const;
+
+    // read(dst, n) fills dst with up to n bytes of the stream, less only at its end
+    std::vector<size_t> MatchChunks(const std::function<size_t(char*, size_t)>& read, size_t chunk_size) const;
 
 public:
 
-    explicit PatternMatchingGPU(const std::vector<std::string>& patterns, const std::string& kernel_name = "match.cl");
+    // kernel_name is a file with the kernel sources to use instead of the built-in gpu/match.cl
+    explicit PatternMatchingGPU(const std::vector<std::string>& patterns, const std::string& kernel_name = {});
+    PatternMatchingGPU(const std::vector<std::string>& patterns, const Options& options, const std::string& kernel_name = {});
+    // take a compiled database, e.g. PatternDatabase::Load of a file, so the patterns aren't preprocessed again
+    explicit PatternMatchingGPU(PatternDatabase database, const std::string& kernel_name = {});
+    PatternMatchingGPU(PatternDatabase database, const Options& options, const std::string& kernel_name = {});
+    // run on the given device, e.g. one of GetDevices(); instances on several devices can share one database
+    PatternMatchingGPU(std::shared_ptr<const PatternDatabase> database, const cl::Device& device, const Options& options,
+                       const std::string& kernel_name = {});
+
+    // every device of the type on every platform
+    static std::vector<cl::Device> GetDevices(cl_device_type type = CL_DEVICE_TYPE_ALL);
+
+    std::vector<size_t> Match(std::string_view text, size_t& time) const;
+    // counts only matches starting before limit, the bytes after it are read to verify them;
+    // this lets a text be split into ranges counted by different engines
+    std::vector<size_t> Match(std::string_view text, size_t limit, size_t& time) const;
+    // the same with the time broken into device commands and host stages
+    std::vector<size_t> Match(std::string_view text, Timing& timing) const;
+    std::vector<size_t> Match(std::string_view text, size_t limit, Timing& timing) const;
+
+    // count the patterns in a text read chunk by chunk, without holding it in memory;
+    // chunk_size bytes are uploaded at a time while the previous chunk is being matched
+    std::vector<size_t> MatchStream(std::istream& in, size_t chunk_size = default_chunk_size) const;
+    std::vector<size_t> MatchStream(int fd, size_t chunk_size = default_chunk_size) const;
+    // Pattern set updates without rebuilding the program or the tables: a removed pattern's entry is emptied
+    // in place and an added one takes the first empty entry of its cell, only those entries are written to the device.
+    // A cell without an empty entry grows to twice its size; the entries of the cells after it move, and the device
+    // gets them and their offsets again from the first grown cell on. Tables take 8 bytes per entry whatever
+    // their depth. The entries buffer grows twice at a time.
+    // Ids are stable: added patterns get the next ids, removed ones keep theirs and are counted as 0 from then on.
+    // Not to be called concurrently with matching. The hashed index isn't updated, so they require Index::Table.
+    // returns the ids of the added patterns
+    std::vector<size_t> AddPatterns(const std::vector<std::string>& patterns);
+    void RemovePatterns(const std::vector<size_t>& ids);
+
+    // Many small texts at once: they are packed into one device buffer and matched by one launch,
+    // and one more for the patterns shorter than 6 bytes; a match never crosses a text boundary. Every work-group sums its matches by (text, pattern),
+    // so what is read back grows with the pairs, not with the matches. Requires device verification.
+    // counts of every pattern in every text, one row per text
+    std::vector<std::vector<size_t>> MatchBatch(const std::vector<std::string_view>& texts, size_t& time) const;
+    // only the nonzero counts, ordered by text and pattern
+    std::vector<Hit> MatchBatchHits(const std::vector<std::string_view>& texts, size_t& time) const;
+
+    // Every match as (pattern, offset), ordered by offset and pattern. The device appends matches to a compact
+    // buffer with one atomic per work-group, so what is read back grows with the matches, not with the text.
+    // Requires device verification.
+    // A cap > 0 bounds the returned positions, overflow then tells if there were more; which ones are kept
+    // is unspecified. Without a cap every match is returned.
+    std::vector<Position> MatchPositions(std::string_view text, size_t& time, size_t cap = 0, bool* overflow = nullptr) const;
 
-    std::vector<size_t> Match(const std::string& text, size_t& time) const;
-    void CheckAnswers(const std::string& text, const std::vector<cl_float2>& answers, size_t step, std::vector<size_t>& res) const;
+    // answers cover positions [0, answers.size()) of the text;
+    // the checks share pooled per-worker counters, so they are not to be called concurrently
+    // answers of the signature tables are entry + 1, whatever the depth
+    void CheckAnswers(std::string_view text, const std::vector<cl_uint>& answers, std::vector<size_t>& res) const;
+    // answers of the hashed index are group + 1, every pattern of the group is verified
+    void CheckGroups(std::string_view text, const std::vector<cl_uint>& answers, std::vector<size_t>& res) const;
 
 };
\ No newline at end of file
@@ -1,57 +1,1241 @@
+// Signature of a text position is its first 6 bytes: bytes 0-1 select a cell (b0 * 256 + b1)
+// of a 256x256 table, bytes 2-5 packed little-endian into a uint are compared with the cell's tag.
+// Tables are one CSR array for all depths: entries are (tag, id) of the patterns of every cell, cell by cell,
+// and the k-th pattern of a cell is entries[bucket_offsets[cell] + k] if that is before bucket_offsets[cell + 1].
+// id is pattern index + 1, an entry with id 0 is a removed pattern or room left for added ones,
+// so zero tags and NUL bytes are valid.
+// Text starts at text_offset of pkt_buffer: a host text wrapped without copying starts inside its first page.
 
-void get_words(__global char* pkt_buffer,
-                 const size_t buffer_size,
-                 const size_t pos,
-                 float *word0x,
-                 float *word0y,
-                 float *word1x,
-                 float *word1y,
-                 float4 *tag0,
-                 float4 *tag1)
+// signatures of positions pos and pos + 1, a position without 6 bytes left gets no signature
+void get_words(__global const uchar* pkt_buffer,
+                 const uint          buffer_size,
+                 const size_t        pos,
+                 uint *cell0,
+                 uint *tag0,
+                 uint *cell1,
+                 uint *tag1)
 {
     const size_t limit = min(7lu, buffer_size - pos);
 
-    *word0x = (limit > 0) ? pkt_buffer[pos] : 0.0;
-    *word0y = *word1x = (limit > 1) ? pkt_buffer[pos + 1] : 0.0;
-    *word1y = (*tag0).s0 = (limit > 2) ? pkt_buffer[pos + 2] : 0.0;
-    (*tag0).s1 = (*tag1).s0 = (limit > 3) ? pkt_buffer[pos + 3] : 0.0;
-    (*tag0).s2 = (*tag1).s1 = (limit > 4) ? pkt_buffer[pos + 4] : 0.0;
-    (*tag0).s3 = (*tag1).s2 = (limit > 5) ? pkt_buffer[pos + 5] : 0.0;
-    (*tag1).s3 = (limit > 6) ? pkt_buffer[pos + 6] : 0.0;
+    uchar b[7];
+    for (size_t k = 0; k < 7; ++k)
+        b[k] = (k < limit) ? pkt_buffer[pos + k] : 0;
+
+    *cell0 = (uint)b[0] << 8 | b[1];
+    *cell1 = (uint)b[1] << 8 | b[2];
+    *tag0 = (uint)b[2] | (uint)b[3] << 8 | (uint)b[4] << 16 | (uint)b[5] << 24;
+    *tag1 = (uint)b[3] | (uint)b[4] << 8 | (uint)b[5] << 16 | (uint)b[6] << 24;
+}
+
+// entry index + 1 of the cell's pattern of this depth if its signature matches the position, 0 if none
+uint find_entry(__global const uint*  bucket_offsets,
+                __global const uint2* entries,
+                  const uint          depth,
+                  const uint          buffer_size,
+                  const size_t        pos,
+                  const uint          cell,
+                  const uint          tag)
+{
+    if (pos + 6 > buffer_size)
+        return 0;
+
+    const uint at = bucket_offsets[cell] + depth;
+    if (at >= bucket_offsets[cell + 1])
+        return 0;
+
+    const uint2 entry = entries[at];
+    return entry.x == tag && entry.y ? at + 1 : 0;
+}
+
+// candidate (pattern index + 1) whose signature matches the position, 0 if none
+uint get_candidate(__global const uint*  bucket_offsets,
+                   __global const uint2* entries,
+                     const uint          depth,
+                     const uint          buffer_size,
+                     const size_t        pos,
+                     const uint          cell,
+                     const uint          tag)
+{
+    const uint entry = find_entry(bucket_offsets, entries, depth, buffer_size, pos, cell, tag);
+    return entry ? entries[entry - 1].y : 0;
 }
 
-__kernel void signature_match(__global char*    pkt_buffer,
-                                const uint      buffer_size,
-                              __global float2*  ans_buffer,
-                              __global float4* table)
+__kernel void signature_match(__global const uchar* pkt_buffer,
+                                const uint          text_offset,
+                                const uint          buffer_size,
+                              __global uint*        ans_buffer,
+                              __global const uint*  bucket_offsets,
+                              __global const uint2* entries,
+                                const uint          depth)
 
 {
-const size_t id = get_global_id(0);
+    pkt_buffer += text_offset;
+
+    const size_t id = get_global_id(0);
 
     const size_t fst = id * 2;
     const size_t scd = fst + 1;
 
-    float word0x = 0.0;
-    float word0y = 0.0;
-    float word1x = 0.0;
-    float word1y = 0.0;
-    float4 tag0 =  (float4)(0.0, 0.0, 0.0, 0.0);
-    float4 tag1 =  (float4)(0.0, 0.0, 0.0, 0.0);
+    if (fst >= buffer_size)
+        return;
+
+    uint cell0 = 0, tag0 = 0, cell1 = 0, tag1 = 0;
+    get_words(pkt_buffer, buffer_size, fst, &cell0, &tag0, &cell1, &tag1);
+
+    // answer is the matched entry + 1, so that 0 means no candidate
+    ans_buffer[fst] = find_entry(bucket_offsets, entries, depth, buffer_size, fst, cell0, tag0);
+    ans_buffer[scd] = find_entry(bucket_offsets, entries, depth, buffer_size, scd, cell1, tag1);
+}
+
+
+#define EMPTY_SLOT 0xFFFFFFFFu
+
+// returns candidate (pattern index + 1) if the whole pattern starts at pos, 0 otherwise;
+// first 6 bytes are already matched by the signature
+uint verify_pattern(__global const uchar* pkt_buffer,
+                      const uint          buffer_size,
+                      const size_t        pos,
+                      const uint          candidate,
+                    __global const uchar* patterns,
+                    __global const uint*  pattern_offsets)
+{
+    if (!candidate)
+        return 0;
+
+    const uint begin = pattern_offsets[candidate - 1];
+    const uint len = pattern_offsets[candidate] - begin;
+
+    if (pos + len > buffer_size)
+        return 0;
+
+    for (uint k = 6; k < len; ++k)
+        if (pkt_buffer[pos + k] != patterns[begin + k])
+            return 0;
+
+    return candidate;
+}
+
+// patterns hit by one work-group are summed in a small local hash of counters,
+// slots that are taken by another pattern fall back to the global counter
+void count_match(const uint            idx,
+                 __global uint*        counts,
+                 __local uint*         cache_ids,
+                 __local uint*         cache_counts)
+{
+    const uint slot = idx % get_local_size(0);
+    const uint prev = atomic_cmpxchg(&cache_ids[slot], EMPTY_SLOT, idx);
+
+    if (prev == EMPTY_SLOT || prev == idx)
+        atomic_inc(&cache_counts[slot]);
+    else
+        atomic_inc(&counts[idx]);
+}
+
+// only matches starting before count_limit are counted, the bytes after it are read
+// to verify them; this lets overlapping chunks of one stream count every match once
+__kernel void signature_count(__global const uchar* pkt_buffer,
+                                const uint          text_offset,
+                                const uint          buffer_size,
+                                const uint          count_limit,
+                              __global const uint*  bucket_offsets,
+                              __global const uint2* entries,
+                                const uint          depth,
+                              __global const uchar* patterns,
+                              __global const uint*  pattern_offsets,
+                              __global uint*        counts,
+                              __local uint*         cache_ids,
+                              __local uint*         cache_counts)
+{
+    pkt_buffer += text_offset;
+
+    const size_t lid = get_local_id(0);
+    cache_ids[lid] = EMPTY_SLOT;
+    cache_counts[lid] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const size_t fst = get_global_id(0) * 2;
+    const size_t scd = fst + 1;
+
+    if (fst < count_limit) {
+        uint cell0 = 0, tag0 = 0, cell1 = 0, tag1 = 0;
+        get_words(pkt_buffer, buffer_size, fst, &cell0, &tag0, &cell1, &tag1);
+
+        const uint candidate0 = get_candidate(bucket_offsets, entries, depth, buffer_size, fst, cell0, tag0);
+        const uint candidate1 = scd < count_limit ? get_candidate(bucket_offsets, entries, depth, buffer_size, scd, cell1, tag1) : 0;
+
+        const uint match0 = verify_pattern(pkt_buffer, buffer_size, fst, candidate0, patterns, pattern_offsets);
+        const uint match1 = verify_pattern(pkt_buffer, buffer_size, scd, candidate1, patterns, pattern_offsets);
+
+        if (match0)
+            count_match(match0 - 1, counts, cache_ids, cache_counts);
+        if (match1)
+            count_match(match1 - 1, counts, cache_ids, cache_counts);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (cache_counts[lid])
+        atomic_add(&counts[cache_ids[lid]], cache_counts[lid]);
+}
+
+
+// Hashed index: a position whose 6 bytes are a key of the cuckoo table matches the key's group,
+// every pattern of the group is verified. One launch covers all patterns whatever the depth.
+// A slot is uint4: key bytes 0-3, key bytes 4-5, group + 1 (0 for an empty slot), unused.
+
+// the two buckets of a key, the same function as PatternDatabase::GetHashBuckets
+void hash_buckets(const ulong key,
+                  const ulong hash_seed,
+                  const uint  hash_mask,
+                  uint *first,
+                  uint *second)
+{
+    ulong hash = (key ^ hash_seed) * 0x9E3779B97F4A7C15ul;
+    *first = (uint)(hash >> 40) & hash_mask;
+
+    hash = (hash ^ hash >> 29) * 0xBF58476D1CE4E5B9ul;
+    *second = (uint)(hash >> 40) & hash_mask;
+}
+
+// group + 1 of the patterns starting with the 6 bytes at pos, 0 if there are none
+uint find_group(__global const uchar* pkt_buffer,
+                  const uint          buffer_size,
+                  const size_t        pos,
+                __global const uint4* slots,
+                  const uint          hash_mask,
+                  const ulong         hash_seed)
+{
+    if (pos + 6 > buffer_size)
+        return 0;
+
+    const uint lo = (uint)pkt_buffer[pos] | (uint)pkt_buffer[pos + 1] << 8
+                  | (uint)pkt_buffer[pos + 2] << 16 | (uint)pkt_buffer[pos + 3] << 24;
+    const uint hi = (uint)pkt_buffer[pos + 4] | (uint)pkt_buffer[pos + 5] << 8;
+
+    uint first = 0, second = 0;
+    hash_buckets((ulong)hi << 32 | lo, hash_seed, hash_mask, &first, &second);
+
+    for (uint k = 0; k < 8; ++k) {
+        const uint4 slot = slots[(k < 4 ? first : second) * 4 + (k & 3)];
+        if (slot.z && slot.x == lo && slot.y == hi)
+            return slot.z;
+    }
+
+    return 0;
+}
+
+// counts every pattern of the group that starts at pos
+void count_group(__global const uchar* pkt_buffer,
+                   const uint          buffer_size,
+                   const size_t        pos,
+                   const uint          group,
+                 __global const uint*  group_offsets,
+                 __global const uint*  group_patterns,
+                 __global const uchar* patterns,
+                 __global const uint*  pattern_offsets,
+                 __global uint*        counts,
+                 __local uint*         cache_ids,
+                 __local uint*         cache_counts)
+{
+    if (!group)
+        return;
+
+    for (uint k = group_offsets[group - 1]; k < group_offsets[group]; ++k) {
+        const uint idx = group_patterns[k];
+        if (verify_pattern(pkt_buffer, buffer_size, pos, idx + 1, patterns, pattern_offsets))
+            count_match(idx, counts, cache_ids, cache_counts);
+    }
+}
+
+__kernel void hash_match(__global const uchar* pkt_buffer,
+                           const uint          text_offset,
+                           const uint          buffer_size,
+                         __global uint*        ans_buffer,
+                         __global const uint4* slots,
+                           const uint          hash_mask,
+                           const ulong         hash_seed)
+{
+    pkt_buffer += text_offset;
+
+    const size_t fst = get_global_id(0) * 2;
+    const size_t scd = fst + 1;
+
+    if (fst >= buffer_size)
+        return;
+
+    // answer is the matched group + 1, so that 0 means no candidate
+    ans_buffer[fst] = find_group(pkt_buffer, buffer_size, fst, slots, hash_mask, hash_seed);
+    ans_buffer[scd] = find_group(pkt_buffer, buffer_size, scd, slots, hash_mask, hash_seed);
+}
+
+// the same count_limit contract as signature_count
+__kernel void hash_count(__global const uchar* pkt_buffer,
+                           const uint          text_offset,
+                           const uint          buffer_size,
+                           const uint          count_limit,
+                         __global const uint4* slots,
+                           const uint          hash_mask,
+                           const ulong         hash_seed,
+                         __global const uint*  group_offsets,
+                         __global const uint*  group_patterns,
+                         __global const uchar* patterns,
+                         __global const uint*  pattern_offsets,
+                         __global uint*        counts,
+                         __local uint*         cache_ids,
+                         __local uint*         cache_counts)
+{
+    pkt_buffer += text_offset;
+
+    const size_t lid = get_local_id(0);
+    cache_ids[lid] = EMPTY_SLOT;
+    cache_counts[lid] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const size_t fst = get_global_id(0) * 2;
+    const size_t scd = fst + 1;
+
+    if (fst < count_limit) {
+        const uint group0 = find_group(pkt_buffer, buffer_size, fst, slots, hash_mask, hash_seed);
+        const uint group1 = scd < count_limit ? find_group(pkt_buffer, buffer_size, scd, slots, hash_mask, hash_seed) : 0;
+
+        count_group(pkt_buffer, buffer_size, fst, group0, group_offsets, group_patterns,
+                    patterns, pattern_offsets, counts, cache_ids, cache_counts);
+        count_group(pkt_buffer, buffer_size, scd, group1, group_offsets, group_patterns,
+                    patterns, pattern_offsets, counts, cache_ids, cache_counts);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (cache_counts[lid])
+        atomic_add(&counts[cache_ids[lid]], cache_counts[lid]);
+}
+
+
+// Batches: many texts packed back to back, text k is [text_offsets[k], text_offsets[k + 1]).
+// Signatures and patterns are checked against the end of their own text, so matches never cross
+// a text boundary. A work-group sums its matches by (text, pattern) in local counters, as count_match
+// does by pattern, and appends one (text, pattern, count) entry per counter to hits, reserving its range
+// with one global atomic; a match that finds no counter goes out as an entry of its own, the host adds
+// equal pairs up. counters are (entries, missed work-groups). A work-group whose entries don't fit
+// in hits_capacity writes none and is listed in missed as (work-group, entries), so the host runs
+// just those again with room for them; with listed set, work-group k runs work-group groups[k].
+
+#define HIT_PROBES 4
+
+// the text holding pos: the last one starting at or before it, so empty texts are skipped
+uint find_text(__global const uint* text_offsets,
+                 const uint         texts_count,
+                 const size_t       pos)
+{
+    uint lo = 0, hi = texts_count;
+    while (hi - lo > 1) {
+        const uint mid = lo + (hi - lo) / 2;
+        if (text_offsets[mid] <= pos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// key of a (text, pattern) pair among the work-group's counters, texts count from the group's first one;
+// EMPTY_SLOT if it doesn't fit 32 bits
+uint hit_key(const uint text,
+             const uint idx,
+             const uint first_text,
+             const uint patterns_count)
+{
+    const ulong key = (ulong)(text - first_text) * patterns_count + idx;
+    return key < EMPTY_SLOT ? (uint)key : EMPTY_SLOT;
+}
+
+// the work-group has two counters per work-item, a key takes the first free or its own of a few from its hash
+bool count_hit(const uint    key,
+               __local uint* cache_ids,
+               __local uint* cache_counts)
+{
+    if (key == EMPTY_SLOT)
+        return false;
+
+    const uint slots = 2 * get_local_size(0);
+    for (uint k = 0; k < HIT_PROBES; ++k) {
+        const uint slot = (key + k) % slots;
+        const uint prev = atomic_cmpxchg(&cache_ids[slot], EMPTY_SLOT, key);
+
+        if (prev == EMPTY_SLOT || prev == key) {
+            atomic_inc(&cache_counts[slot]);
+            return true;
+        }
+    }
+    return false;
+}
+
+// whether count_hit has counted the key, once the whole work-group is done counting:
+// counters are never freed, so a key that found none then would find none now either
+bool counted_hit(const uint          key,
+                 __local const uint* cache_ids)
+{
+    if (key == EMPTY_SLOT)
+        return false;
+
+    const uint slots = 2 * get_local_size(0);
+    for (uint k = 0; k < HIT_PROBES; ++k)
+        if (cache_ids[(key + k) % slots] == key)
+            return true;
+    return false;
+}
+
+void write_hit(const uint     text,
+               const uint     idx,
+               const uint     count,
+               const uint     place,
+               __global uint* hits)
+{
+    hits[place * 3] = text;
+    hits[place * 3 + 1] = idx;
+    hits[place * 3 + 2] = count;
+}
+
+// a match of the batch: while hits is 0 it is counted in the work-group's counters, otherwise
+// it is written at place unless it was counted; returns 1 if it has no counter
+uint add_hit(const uint     text,
+             const uint     idx,
+             const uint     first_text,
+             const uint     patterns_count,
+             __local uint*  cache_ids,
+             __local uint*  cache_counts,
+             __global uint* hits,
+             const uint     place)
+{
+    const uint key = hit_key(text, idx, first_text, patterns_count);
+    if (!hits)
+        return !count_hit(key, cache_ids, cache_counts);
+
+    if (counted_hit(key, cache_ids))
+        return 0;
+
+    write_hit(text, idx, 1, place, hits);
+    return 1;
+}
+
+// place of the work-item's first entry, as reserve_positions, or hits_capacity if the work-group's entries
+// don't fit: then it takes no places, so counters[0] never passes hits_capacity, and is listed in missed
+uint reserve_hits(const uint      entries,
+                  const uint      group,
+                  __global uint*  counters,
+                  __global uint2* missed,
+                  const uint      hits_capacity,
+                  __local uint*   group_range)
+{
+    const uint at = atomic_add(&group_range[0], entries);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (get_local_id(0) == 0) {
+        const uint total = group_range[0];
+        uint place = 0;
+
+        if (total) {
+            uint prev = atomic_cmpxchg(&counters[0], 0, 0);
+            do {
+                place = prev;
+                if (total > hits_capacity - place) {
+                    place = hits_capacity;
+                    break;
+                }
+                prev = atomic_cmpxchg(&counters[0], place, place + total);
+            } while (prev != place);
+
+            if (place == hits_capacity)
+                missed[atomic_inc(&counters[1])] = (uint2)(group, total);
+        }
+        group_range[1] = place;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    return group_range[1] == hits_capacity ? hits_capacity : group_range[1] + at;
+}
+
+// writes the entries of the work-item's counters from place on, returns the place after them
+uint write_counters(const uint          first_text,
+                    const uint          patterns_count,
+                    __local const uint* cache_ids,
+                    __local const uint* cache_counts,
+                    __global uint*      hits,
+                    uint                place)
+{
+    for (uint slot = get_local_id(0); slot < 2 * get_local_size(0); slot += get_local_size(0))
+        if (cache_counts[slot])
+            write_hit(first_text + cache_ids[slot] / patterns_count, cache_ids[slot] % patterns_count,
+                      cache_counts[slot], place++, hits);
+    return place;
+}
+
+// matches at pos of every pattern of the cell, all depths at once; see add_hit
+uint signature_hits(__global const uchar* pkt_buffer,
+                      const uint          text_end,
+                      const size_t        pos,
+                      const uint          text,
+                      const uint          cell,
+                      const uint          tag,
+                    __global const uint*  bucket_offsets,
+                    __global const uint2* entries,
+                    __global const uchar* patterns,
+                    __global const uint*  pattern_offsets,
+                      const uint          first_text,
+                      const uint          patterns_count,
+                    __local uint*         cache_ids,
+                    __local uint*         cache_counts,
+                    __global uint*        hits,
+                      const uint          place)
+{
+    if (pos + 6 > text_end)
+        return 0;
+
+    uint missed = 0;
+    for (uint at = bucket_offsets[cell]; at < bucket_offsets[cell + 1]; ++at) {
+        const uint2 entry = entries[at];
+        if (entry.x == tag && verify_pattern(pkt_buffer, text_end, pos, entry.y, patterns, pattern_offsets))
+            missed += add_hit(text, entry.y - 1, first_text, patterns_count, cache_ids, cache_counts, hits, place + missed);
+    }
+    return missed;
+}
+
+__kernel void batch_signature_count(__global const uchar* pkt_buffer,
+                                      const uint          buffer_size,
+                                    __global const uint*  text_offsets,
+                                      const uint          texts_count,
+                                    __global const uint*  bucket_offsets,
+                                    __global const uint2* entries,
+                                    __global const uchar* patterns,
+                                    __global const uint*  pattern_offsets,
+                                      const uint          patterns_count,
+                                    __global const uint*  groups,
+                                      const uint          listed,
+                                    __global uint*        hits,
+                                    __global uint*        counters,
+                                    __global uint2*       missed_groups,
+                                      const uint          hits_capacity,
+                                    __local uint*         cache_ids,
+                                    __local uint*         cache_counts,
+                                    __local uint*         group_range)
+{
+    const size_t lid = get_local_id(0);
+    const size_t local_size = get_local_size(0);
+
+    cache_ids[lid] = cache_ids[lid + local_size] = EMPTY_SLOT;
+    cache_counts[lid] = cache_counts[lid + local_size] = 0;
+    if (lid == 0)
+        group_range[0] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const uint group = listed ? groups[get_group_id(0)] : get_group_id(0);
+    const size_t start = (size_t)group * local_size * 2;
+    const uint first_text = find_text(text_offsets, texts_count, start);
+
+    const size_t fst = start + lid * 2;
+    const size_t scd = fst + 1;
+
+    uint cell0 = 0, tag0 = 0, cell1 = 0, tag1 = 0;
+    uint text0 = 0, end0 = 0, text1 = 0, end1 = 0;
+    uint missed = 0;
+
+    if (fst < buffer_size) {
+        get_words(pkt_buffer, buffer_size, fst, &cell0, &tag0, &cell1, &tag1);
+
+        text0 = find_text(text_offsets, texts_count, fst);
+        end0 = text_offsets[text0 + 1];
+        missed += signature_hits(pkt_buffer, end0, fst, text0, cell0, tag0, bucket_offsets, entries, patterns,
+                                 pattern_offsets, first_text, patterns_count, cache_ids, cache_counts, 0, 0);
+
+        text1 = scd < end0 ? text0 : find_text(text_offsets, texts_count, scd);
+        end1 = text_offsets[text1 + 1];
+        if (scd < buffer_size)
+            missed += signature_hits(pkt_buffer, end1, scd, text1, cell1, tag1, bucket_offsets, entries, patterns,
+                                     pattern_offsets, first_text, patterns_count, cache_ids, cache_counts, 0, 0);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const uint counted = (cache_counts[lid] != 0) + (cache_counts[lid + local_size] != 0);
+    uint place = reserve_hits(counted + missed, group, counters, missed_groups, hits_capacity, group_range);
+    if (place == hits_capacity)
+        return;
+
+    place = write_counters(first_text, patterns_count, cache_ids, cache_counts, hits, place);
+
+    if (missed) {
+        place += signature_hits(pkt_buffer, end0, fst, text0, cell0, tag0, bucket_offsets, entries, patterns,
+                                pattern_offsets, first_text, patterns_count, cache_ids, cache_counts, hits, place);
+        if (scd < buffer_size)
+            signature_hits(pkt_buffer, end1, scd, text1, cell1, tag1, bucket_offsets, entries, patterns,
+                           pattern_offsets, first_text, patterns_count, cache_ids, cache_counts, hits, place);
+    }
+}
+
+// matches at pos of every pattern of the group; see add_hit
+uint group_hits(__global const uchar* pkt_buffer,
+                  const uint          text_end,
+                  const size_t        pos,
+                  const uint          text,
+                  const uint          group,
+                __global const uint*  group_offsets,
+                __global const uint*  group_patterns,
+                __global const uchar* patterns,
+                __global const uint*  pattern_offsets,
+                  const uint          first_text,
+                  const uint          patterns_count,
+                __local uint*         cache_ids,
+                __local uint*         cache_counts,
+                __global uint*        hits,
+                  const uint          place)
+{
+    if (!group)
+        return 0;
+
+    uint missed = 0;
+    for (uint k = group_offsets[group - 1]; k < group_offsets[group]; ++k) {
+        const uint idx = group_patterns[k];
+        if (verify_pattern(pkt_buffer, text_end, pos, idx + 1, patterns, pattern_offsets))
+            missed += add_hit(text, idx, first_text, patterns_count, cache_ids, cache_counts, hits, place + missed);
+    }
+    return missed;
+}
+
+__kernel void batch_hash_count(__global const uchar* pkt_buffer,
+                                 const uint          buffer_size,
+                               __global const uint*  text_offsets,
+                                 const uint          texts_count,
+                               __global const uint4* slots,
+                                 const uint          hash_mask,
+                                 const ulong         hash_seed,
+                               __global const uint*  group_offsets,
+                               __global const uint*  group_patterns,
+                               __global const uchar* patterns,
+                               __global const uint*  pattern_offsets,
+                                 const uint          patterns_count,
+                               __global const uint*  groups,
+                                 const uint          listed,
+                               __global uint*        hits,
+                               __global uint*        counters,
+                               __global uint2*       missed_groups,
+                                 const uint          hits_capacity,
+                               __local uint*         cache_ids,
+                               __local uint*         cache_counts,
+                               __local uint*         group_range)
+{
+    const size_t lid = get_local_id(0);
+    const size_t local_size = get_local_size(0);
+
+    cache_ids[lid] = cache_ids[lid + local_size] = EMPTY_SLOT;
+    cache_counts[lid] = cache_counts[lid + local_size] = 0;
+    if (lid == 0)
+        group_range[0] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const uint work_group = listed ? groups[get_group_id(0)] : get_group_id(0);
+    const size_t start = (size_t)work_group * local_size * 2;
+    const uint first_text = find_text(text_offsets, texts_count, start);
+
+    const size_t fst = start + lid * 2;
+    const size_t scd = fst + 1;
+
+    uint group0 = 0, group1 = 0;
+    uint text0 = 0, end0 = 0, text1 = 0, end1 = 0;
+    uint missed = 0;
+
+    if (fst < buffer_size) {
+        text0 = find_text(text_offsets, texts_count, fst);
+        end0 = text_offsets[text0 + 1];
+        group0 = find_group(pkt_buffer, end0, fst, slots, hash_mask, hash_seed);
+        missed += group_hits(pkt_buffer, end0, fst, text0, group0, group_offsets, group_patterns, patterns,
+                             pattern_offsets, first_text, patterns_count, cache_ids, cache_counts, 0, 0);
+
+        text1 = scd < end0 ? text0 : find_text(text_offsets, texts_count, scd);
+        end1 = text_offsets[text1 + 1];
+        if (scd < buffer_size) {
+            group1 = find_group(pkt_buffer, end1, scd, slots, hash_mask, hash_seed);
+            missed += group_hits(pkt_buffer, end1, scd, text1, group1, group_offsets, group_patterns, patterns,
+                                 pattern_offsets, first_text, patterns_count, cache_ids, cache_counts, 0, 0);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const uint counted = (cache_counts[lid] != 0) + (cache_counts[lid + local_size] != 0);
+    uint place = reserve_hits(counted + missed, work_group, counters, missed_groups, hits_capacity, group_range);
+    if (place == hits_capacity)
+        return;
+
+    place = write_counters(first_text, patterns_count, cache_ids, cache_counts, hits, place);
+
+    if (missed) {
+        place += group_hits(pkt_buffer, end0, fst, text0, group0, group_offsets, group_patterns, patterns,
+                            pattern_offsets, first_text, patterns_count, cache_ids, cache_counts, hits, place);
+        group_hits(pkt_buffer, end1, scd, text1, group1, group_offsets, group_patterns, patterns,
+                   pattern_offsets, first_text, patterns_count, cache_ids, cache_counts, hits, place);
+    }
+}
+
+
+// Positions: every match starting before count_limit is written to positions as (pattern index, offset).
+// A work-item takes consecutive places for its matches from a work-group counter in local memory,
+// then one work-item reserves the group's range with a single global atomic, so the buffer is compact
+// and the host reads back only the matches. Past positions_capacity only positions_count grows.
+
+// place of the work-item's first match in the global buffer; group_range is two local uints
+uint reserve_positions(const uint      matches,
+                       __global uint*  positions_count,
+                       __local uint*   group_range)
+{
+    const uint at = atomic_add(&group_range[0], matches);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (get_local_id(0) == 0)
+        group_range[1] = group_range[0] ? atomic_add(positions_count, group_range[0]) : 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    return group_range[1] + at;
+}
+
+void write_position(const uint      idx,
+                    const size_t    pos,
+                    const uint      place,
+                    __global uint2* positions,
+                    const uint      positions_capacity)
+{
+    if (place < positions_capacity)
+        positions[place] = (uint2)(idx, (uint)pos);
+}
+
+__kernel void signature_positions(__global const uchar* pkt_buffer,
+                                    const uint          text_offset,
+                                    const uint          buffer_size,
+                                    const uint          count_limit,
+                                  __global const uint*  bucket_offsets,
+                                  __global const uint2* entries,
+                                    const uint          depth,
+                                  __global const uchar* patterns,
+                                  __global const uint*  pattern_offsets,
+                                  __global uint2*       positions,
+                                  __global uint*        positions_count,
+                                    const uint          positions_capacity,
+                                  __local uint*         group_range)
+{
+    pkt_buffer += text_offset;
+
+    if (get_local_id(0) == 0)
+        group_range[0] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const size_t fst = get_global_id(0) * 2;
+    const size_t scd = fst + 1;
+
+    uint match0 = 0, match1 = 0;
+    if (fst < count_limit) {
+        uint cell0 = 0, tag0 = 0, cell1 = 0, tag1 = 0;
+        get_words(pkt_buffer, buffer_size, fst, &cell0, &tag0, &cell1, &tag1);
 
-    get_words(pkt_buffer, buffer_size, fst, &word0x, &word0y, &word1x, &word1y, &tag0, &tag1);
+        const uint candidate0 = get_candidate(bucket_offsets, entries, depth, buffer_size, fst, cell0, tag0);
+        const uint candidate1 = scd < count_limit ? get_candidate(bucket_offsets, entries, depth, buffer_size, scd, cell1, tag1) : 0;
 
-    const size_t i = (size_t)word0x * 256 + (size_t)word0y;
-    const size_t j = (size_t)word1x * 256 + (size_t)word1y;
+        match0 = verify_pattern(pkt_buffer, buffer_size, fst, candidate0, patterns, pattern_offsets);
+        match1 = verify_pattern(pkt_buffer, buffer_size, scd, candidate1, patterns, pattern_offsets);
+    }
 
-    const float4 h0 = table[i];
-    const float4 h1 = table[j];
+    // every work-item takes part in the reservation, since it has barriers
+    uint place = reserve_positions((match0 != 0) + (match1 != 0), positions_count, group_range);
 
-    const float2 word0 = (float2)(word0x, word0y);
-    const float2 word1 = (float2)(word1x, word1y);
+    if (match0)
+        write_position(match0 - 1, fst, place++, positions, positions_capacity);
+    if (match1)
+        write_position(match1 - 1, scd, place, positions, positions_capacity);
+}
 
-    const float all_match0 = all(h0 == tag0);
-    const float all_match1 = all(h1 == tag1);
+// patterns of the group that start at pos; they are written from place on unless positions is 0
+uint group_positions(__global const uchar* pkt_buffer,
+                       const uint          buffer_size,
+                       const size_t        pos,
+                       const uint          group,
+                     __global const uint*  group_offsets,
+                     __global const uint*  group_patterns,
+                     __global const uchar* patterns,
+                     __global const uint*  pattern_offsets,
+                       uint                place,
+                     __global uint2*       positions,
+                       const uint          positions_capacity)
+{
+    if (!group)
+        return 0;
 
-    ans_buffer[fst] = word0 * all_match0;
-    ans_buffer[scd] = word1 * all_match1;
-}
\ No newline at end of file
+    uint matches = 0;
+    for (uint k = group_offsets[group - 1]; k < group_offsets[group]; ++k) {
+        const uint idx = group_patterns[k];
+        if (!verify_pattern(pkt_buffer, buffer_size, pos, idx + 1, patterns, pattern_offsets))
+            continue;
+
+        if (positions)
+            write_position(idx, pos, place + matches, positions, positions_capacity);
+        ++matches;
+    }
+
+    return matches;
+}
+
+__kernel void hash_positions(__global const uchar* pkt_buffer,
+                               const uint          text_offset,
+                               const uint          buffer_size,
+                               const uint          count_limit,
+                             __global const uint4* slots,
+                               const uint          hash_mask,
+                               const ulong         hash_seed,
+                             __global const uint*  group_offsets,
+                             __global const uint*  group_patterns,
+                             __global const uchar* patterns,
+                             __global const uint*  pattern_offsets,
+                             __global uint2*       positions,
+                             __global uint*        positions_count,
+                               const uint          positions_capacity,
+                             __local uint*         group_range)
+{
+    pkt_buffer += text_offset;
+
+    if (get_local_id(0) == 0)
+        group_range[0] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const size_t fst = get_global_id(0) * 2;
+    const size_t scd = fst + 1;
+
+    uint group0 = 0, group1 = 0;
+    if (fst < count_limit) {
+        group0 = find_group(pkt_buffer, buffer_size, fst, slots, hash_mask, hash_seed);
+        group1 = scd < count_limit ? find_group(pkt_buffer, buffer_size, scd, slots, hash_mask, hash_seed) : 0;
+    }
+
+    // groups are verified twice: once to count the places, once to fill them
+    const uint matches0 = group_positions(pkt_buffer, buffer_size, fst, group0, group_offsets, group_patterns,
+                                          patterns, pattern_offsets, 0, 0, 0);
+    const uint matches1 = group_positions(pkt_buffer, buffer_size, scd, group1, group_offsets, group_patterns,
+                                          patterns, pattern_offsets, 0, 0, 0);
+
+    const uint place = reserve_positions(matches0 + matches1, positions_count, group_range);
+
+    group_positions(pkt_buffer, buffer_size, fst, group0, group_offsets, group_patterns,
+                    patterns, pattern_offsets, place, positions, positions_capacity);
+    group_positions(pkt_buffer, buffer_size, scd, group1, group_offsets, group_patterns,
+                    patterns, pattern_offsets, place + matches0, positions, positions_capacity);
+}
+
+
+// Short patterns (1-5 bytes) are counted by one launch over the text. 1- and 2-byte patterns are looked up
+// directly: direct[b0] and direct[256 + (b0 << 8 | b1)] hold pattern index + 1 (0 if none). Longer ones
+// are filtered by a bitmap of their first two bytes and looked up in an open-addressed table of
+// uint4 slots: key bytes 0-3, key byte 4 | length << 8, pattern index + 1 (0 for an empty slot), unused.
+// lengths has bit n set when there are patterns of n bytes; probes bounds the linear probing.
+
+// pattern index + 1 of the len-byte key, 0 if none
+uint find_short(const uchar*        b,
+                const uint          len,
+                __global const uint4* slots,
+                const uint          slots_mask,
+                const uint          probes)
+{
+    uint lo = 0, hi = (uint)len << 8;
+    for (uint k = 0; k < len; ++k) {
+        if (k < 4)
+            lo |= (uint)b[k] << (k * 8);
+        else
+            hi |= b[k];
+    }
+
+    const ulong hash = ((ulong)hi << 32 | lo) * 0x9E3779B97F4A7C15ul;
+    const uint first = (uint)(hash >> 32);
+
+    for (uint k = 0; k < probes; ++k) {
+        const uint4 slot = slots[(first + k) & slots_mask];
+        if (!slot.z)
+            return 0;
+        if (slot.x == lo && slot.y == hi)
+            return slot.z;
+    }
+
+    return 0;
+}
+
+// pattern indices + 1 of the short patterns starting at pos and ending by text_end, at most one of each
+// length since duplicates aren't in the tables; returns how many there are
+uint find_shorts(__global const uchar* pkt_buffer,
+                   const size_t        text_end,
+                   const size_t        pos,
+                 __global const uint*  direct,
+                 __global const uint*  prefixes,
+                 __global const uint4* slots,
+                   const uint          slots_mask,
+                   const uint          probes,
+                   const uint          lengths,
+                 uint*                 matches)
+{
+    const uint size = (uint)min(5lu, text_end - pos);
+
+    uchar b[5];
+    for (uint k = 0; k < 5; ++k)
+        b[k] = k < size ? pkt_buffer[pos + k] : 0;
+
+    uint found = 0;
+    const uint one = direct[b[0]];
+    if (one)
+        matches[found++] = one;
+
+    if (size < 2)
+        return found;
+
+    const uint cell = (uint)b[0] << 8 | b[1];
+    const uint two = direct[256 + cell];
+    if (two)
+        matches[found++] = two;
+
+    if (!(prefixes[cell >> 5] & 1u << (cell & 31)))
+        return found;
+
+    for (uint len = 3; len <= size; ++len) {
+        const uint match = (lengths & 1u << len) ? find_short(b, len, slots, slots_mask, probes) : 0;
+        if (match)
+            matches[found++] = match;
+    }
+    return found;
+}
+
+void count_short(__global const uchar* pkt_buffer,
+                   const uint          buffer_size,
+                   const size_t        pos,
+                 __global const uint*  direct,
+                 __global const uint*  prefixes,
+                 __global const uint4* slots,
+                   const uint          slots_mask,
+                   const uint          probes,
+                   const uint          lengths,
+                 __global uint*        counts,
+                 __local uint*         cache_ids,
+                 __local uint*         cache_counts)
+{
+    uint matches[5];
+    const uint found = find_shorts(pkt_buffer, buffer_size, pos, direct, prefixes, slots, slots_mask, probes, lengths,
+                                   matches);
+    for (uint k = 0; k < found; ++k)
+        count_match(matches[k] - 1, counts, cache_ids, cache_counts);
+}
+
+// the same count_limit contract as signature_count
+__kernel void short_count(__global const uchar* pkt_buffer,
+                            const uint          text_offset,
+                            const uint          buffer_size,
+                            const uint          count_limit,
+                          __global const uint*  direct,
+                          __global const uint*  prefixes,
+                          __global const uint4* slots,
+                            const uint          slots_mask,
+                            const uint          probes,
+                            const uint          lengths,
+                          __global uint*        counts,
+                          __local uint*         cache_ids,
+                          __local uint*         cache_counts)
+{
+    pkt_buffer += text_offset;
+
+    const size_t lid = get_local_id(0);
+    cache_ids[lid] = EMPTY_SLOT;
+    cache_counts[lid] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const size_t fst = get_global_id(0) * 2;
+    const size_t scd = fst + 1;
+
+    if (fst < count_limit)
+        count_short(pkt_buffer, buffer_size, fst, direct, prefixes, slots, slots_mask, probes, lengths,
+                    counts, cache_ids, cache_counts);
+    if (scd < count_limit)
+        count_short(pkt_buffer, buffer_size, scd, direct, prefixes, slots, slots_mask, probes, lengths,
+                    counts, cache_ids, cache_counts);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (cache_counts[lid])
+        atomic_add(&counts[cache_ids[lid]], cache_counts[lid]);
+}
+
+
+// short_count writing positions, see signature_positions
+__kernel void short_positions(__global const uchar* pkt_buffer,
+                                const uint          text_offset,
+                                const uint          buffer_size,
+                                const uint          count_limit,
+                              __global const uint*  direct,
+                              __global const uint*  prefixes,
+                              __global const uint4* slots,
+                                const uint          slots_mask,
+                                const uint          probes,
+                                const uint          lengths,
+                              __global uint2*       positions,
+                              __global uint*        positions_count,
+                                const uint          positions_capacity,
+                              __local uint*         group_range)
+{
+    pkt_buffer += text_offset;
+
+    if (get_local_id(0) == 0)
+        group_range[0] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const size_t fst = get_global_id(0) * 2;
+    const size_t scd = fst + 1;
+
+    uint matches0[5], matches1[5];
+    uint found0 = 0, found1 = 0;
+    if (fst < count_limit)
+        found0 = find_shorts(pkt_buffer, buffer_size, fst, direct, prefixes, slots, slots_mask, probes, lengths, matches0);
+    if (scd < count_limit)
+        found1 = find_shorts(pkt_buffer, buffer_size, scd, direct, prefixes, slots, slots_mask, probes, lengths, matches1);
+
+    uint place = reserve_positions(found0 + found1, positions_count, group_range);
+
+    for (uint k = 0; k < found0; ++k)
+        write_position(matches0[k] - 1, fst, place++, positions, positions_capacity);
+    for (uint k = 0; k < found1; ++k)
+        write_position(matches1[k] - 1, scd, place++, positions, positions_capacity);
+}
+
+// short matches at pos, which lies in text; see add_hit
+uint short_hits(__global const uchar* pkt_buffer,
+                  const uint          text_end,
+                  const size_t        pos,
+                  const uint          text,
+                __global const uint*  direct,
+                __global const uint*  prefixes,
+                __global const uint4* slots,
+                  const uint          slots_mask,
+                  const uint          probes,
+                  const uint          lengths,
+                  const uint          first_text,
+                  const uint          patterns_count,
+                __local uint*         cache_ids,
+                __local uint*         cache_counts,
+                __global uint*        hits,
+                  const uint          place)
+{
+    uint matches[5];
+    const uint found = find_shorts(pkt_buffer, text_end, pos, direct, prefixes, slots, slots_mask, probes, lengths,
+                                   matches);
+
+    uint missed = 0;
+    for (uint k = 0; k < found; ++k)
+        missed += add_hit(text, matches[k] - 1, first_text, patterns_count, cache_ids, cache_counts, hits, place + missed);
+    return missed;
+}
+
+// short_count over a batch, with the contract of batch_signature_count; a launch of its own appends
+// to the same hits before the longer patterns' one
+__kernel void batch_short_count(__global const uchar* pkt_buffer,
+                                  const uint          buffer_size,
+                                __global const uint*  text_offsets,
+                                  const uint          texts_count,
+                                __global const uint*  direct,
+                                __global const uint*  prefixes,
+                                __global const uint4* slots,
+                                  const uint          slots_mask,
+                                  const uint          probes,
+                                  const uint          lengths,
+                                  const uint          patterns_count,
+                                __global const uint*  groups,
+                                  const uint          listed,
+                                __global uint*        hits,
+                                __global uint*        counters,
+                                __global uint2*       missed_groups,
+                                  const uint          hits_capacity,
+                                __local uint*         cache_ids,
+                                __local uint*         cache_counts,
+                                __local uint*         group_range)
+{
+    const size_t lid = get_local_id(0);
+    const size_t local_size = get_local_size(0);
+
+    cache_ids[lid] = cache_ids[lid + local_size] = EMPTY_SLOT;
+    cache_counts[lid] = cache_counts[lid + local_size] = 0;
+    if (lid == 0)
+        group_range[0] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const uint group = listed ? groups[get_group_id(0)] : get_group_id(0);
+    const size_t start = (size_t)group * local_size * 2;
+    const uint first_text = find_text(text_offsets, texts_count, start);
+
+    const size_t fst = start + lid * 2;
+    const size_t scd = fst + 1;
+
+    uint text0 = 0, end0 = 0, text1 = 0, end1 = 0;
+    uint missed = 0;
+
+    if (fst < buffer_size) {
+        text0 = find_text(text_offsets, texts_count, fst);
+        end0 = text_offsets[text0 + 1];
+        missed += short_hits(pkt_buffer, end0, fst, text0, direct, prefixes, slots, slots_mask, probes, lengths,
+                             first_text, patterns_count, cache_ids, cache_counts, 0, 0);
+
+        text1 = scd < end0 ? text0 : find_text(text_offsets, texts_count, scd);
+        end1 = text_offsets[text1 + 1];
+        if (scd < buffer_size)
+            missed += short_hits(pkt_buffer, end1, scd, text1, direct, prefixes, slots, slots_mask, probes, lengths,
+                                 first_text, patterns_count, cache_ids, cache_counts, 0, 0);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const uint counted = (cache_counts[lid] != 0) + (cache_counts[lid + local_size] != 0);
+    uint place = reserve_hits(counted + missed, group, counters, missed_groups, hits_capacity, group_range);
+    if (place == hits_capacity)
+        return;
+
+    place = write_counters(first_text, patterns_count, cache_ids, cache_counts, hits, place);
+
+    if (missed) {
+        place += short_hits(pkt_buffer, end0, fst, text0, direct, prefixes, slots, slots_mask, probes, lengths,
+                            first_text, patterns_count, cache_ids, cache_counts, hits, place);
+        if (scd < buffer_size)
+            short_hits(pkt_buffer, end1, scd, text1, direct, prefixes, slots, slots_mask, probes, lengths,
+                       first_text, patterns_count, cache_ids, cache_counts, hits, place);
+    }
+}
+
+// Tiled signature kernels: a work-group copies the text of its positions, plus the 5 bytes of halo their
+// signatures reach into, to local memory with vload16; every work-item then takes per_item consecutive
+// positions and shifts one byte of the tile into its signature per position. The text is read from global
+// memory about once per work-group instead of 7 bytes per work-item; patterns are still verified from it.
+// The tile is get_local_size(0) * per_item + 5 bytes rounded up to 16, what the host allocates for it.
+
+uint tile_size(const uint per_item)
+{
+    return (get_local_size(0) * per_item + 5 + 15) / 16 * 16;
+}
+
+// copies tile_size bytes of the text from tile_start to tile, bytes past buffer_size as 0;
+// the caller waits for the whole work-group with a barrier
+void load_tile(__global const uchar* pkt_buffer,
+                 const uint          buffer_size,
+                 const size_t        tile_start,
+                 const uint          size,
+               __local uchar*        tile)
+{
+    for (uint chunk = get_local_id(0); chunk < size / 16; chunk += get_local_size(0)) {
+        const size_t at = tile_start + chunk * 16;
+
+        if (at + 16 <= buffer_size) {
+            vstore16(vload16(0, pkt_buffer + at), chunk, tile);
+        } else {
+            for (uint k = 0; k < 16; ++k)
+                tile[chunk * 16 + k] = at + k < buffer_size ? pkt_buffer[at + k] : 0;
+        }
+    }
+}
+
+// signature of the position at tile[at] without its last byte, which shift_signature adds
+void start_signature(__local const uchar* tile,
+                       const uint         at,
+                       uint *cell,
+                       uint *tag)
+{
+    *cell = (uint)tile[at] << 8 | tile[at + 1];
+    *tag = (uint)tile[at + 2] | (uint)tile[at + 3] << 8 | (uint)tile[at + 4] << 16;
+}
+
+// completes the signature with its last byte, to be called once per position
+void complete_signature(const uchar last, uint *tag)
+{
+    *tag |= (uint)last << 24;
+}
+
+// moves a complete signature to the next position, again without its last byte
+void shift_signature(uint *cell, uint *tag)
+{
+    *cell = (*cell << 8 | (*tag & 0xFF)) & 0xFFFF;
+    *tag >>= 8;
+}
+
+// signature_match with per_item positions per work-item, answers are written for positions before count_limit
+__kernel void signature_match_tiled(__global const uchar* pkt_buffer,
+                                      const uint          text_offset,
+                                      const uint          buffer_size,
+                                    __global uint*        ans_buffer,
+                                    __global const uint*  bucket_offsets,
+                                    __global const uint2* entries,
+                                      const uint          depth,
+                                      const uint          count_limit,
+                                      const uint          per_item,
+                                    __local uchar*        tile)
+{
+    pkt_buffer += text_offset;
+
+    const size_t tile_start = get_group_id(0) * get_local_size(0) * per_item;
+    load_tile(pkt_buffer, buffer_size, tile_start, tile_size(per_item), tile);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const uint first = get_local_id(0) * per_item;
+
+    uint cell = 0, tag = 0;
+    start_signature(tile, first, &cell, &tag);
+
+    for (uint k = 0; k < per_item; ++k) {
+        const size_t pos = tile_start + first + k;
+        if (pos >= count_limit)
+            break;
+
+        complete_signature(tile[first + k + 5], &tag);
+
+        ans_buffer[pos] = find_entry(bucket_offsets, entries, depth, buffer_size, pos, cell, tag);
+
+        shift_signature(&cell, &tag);
+    }
+}
+
+// signature_count with per_item positions per work-item
+__kernel void signature_count_tiled(__global const uchar* pkt_buffer,
+                                      const uint          text_offset,
+                                      const uint          buffer_size,
+                                      const uint          count_limit,
+                                    __global const uint*  bucket_offsets,
+                                    __global const uint2* entries,
+                                      const uint          depth,
+                                    __global const uchar* patterns,
+                                    __global const uint*  pattern_offsets,
+                                    __global uint*        counts,
+                                    __local uint*         cache_ids,
+                                    __local uint*         cache_counts,
+                                      const uint          per_item,
+                                    __local uchar*        tile)
+{
+    pkt_buffer += text_offset;
+
+    const size_t lid = get_local_id(0);
+    cache_ids[lid] = EMPTY_SLOT;
+    cache_counts[lid] = 0;
+
+    const size_t tile_start = get_group_id(0) * get_local_size(0) * per_item;
+    load_tile(pkt_buffer, buffer_size, tile_start, tile_size(per_item), tile);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const uint first = lid * per_item;
+
+    uint cell = 0, tag = 0;
+    start_signature(tile, first, &cell, &tag);
+
+    for (uint k = 0; k < per_item; ++k) {
+        const size_t pos = tile_start + first + k;
+        if (pos >= count_limit)
+            break;
+
+        complete_signature(tile[first + k + 5], &tag);
+
+        const uint candidate = get_candidate(bucket_offsets, entries, depth, buffer_size, pos, cell, tag);
+        const uint match = verify_pattern(pkt_buffer, buffer_size, pos, candidate, patterns, pattern_offsets);
+        if (match)
+            count_match(match - 1, counts, cache_ids, cache_counts);
+
+        shift_signature(&cell, &tag);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (cache_counts[lid])
+        atomic_add(&counts[cache_ids[lid]], cache_counts[lid]);
+}
@@ -0,0 +1,433 @@
+#include "pattern_database.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+
+struct PatternDatabase::Header {
+    struct Range {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // written as byte_order_mark_, reads differently on a host of the other endianness
+    uint64_t alignment;  // of every section offset
+    uint64_t patterns_count;
+    uint64_t max_depth;
+    uint64_t hash_buckets_count;
+    uint64_t hash_seed;
+    uint64_t groups_count;
+    std::array<Range, SectionsCount> sections;
+};
+
+namespace {
+
+    constexpr char magic[8] = {'P', 'M', 'D', 'B', 0, 0, 0, 0};
+    constexpr uint32_t byte_order_mark = 0x01020304;
+
+    // page size of every common platform, so each section of a mapped file starts on its own page
+    constexpr size_t alignment = 4096;
+
+    size_t AlignUp(size_t size) {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    uint64_t PackKey(std::string_view prefix) {
+        uint64_t key = 0;
+        for (size_t i = PatternDatabase::prefix_size; i-- > 0;)
+            key = key << 8 | static_cast<unsigned char>(prefix[i]);
+        return key;
+    }
+
+    // the buckets index bits 40-63 of a hash
+    constexpr size_t max_hash_buckets = size_t(1) << 24;
+
+    // cuckoo table of keys mapping to group + 1: a key goes to a free slot of one of its two buckets,
+    // or takes a random slot of them and the evicted key moves on to its other bucket
+    class HashTableBuilder {
+    public:
+        explicit HashTableBuilder(const std::vector<uint64_t>& keys) : keys_(keys) {}
+
+        // grows the table and changes the seed until every key is placed, returns the slots as stored in the image
+        std::vector<uint32_t> Build(size_t& buckets_count, uint64_t& seed) {
+
+            // at most 3/4 of the slots are used
+            buckets_count = 1;
+            while (buckets_count * PatternDatabase::bucket_slots * 3 < keys_.size() * 4)
+                buckets_count *= 2;
+
+            for (size_t attempt = 1;; ++attempt) {
+                if (buckets_count > max_hash_buckets)
+                    throw std::length_error("Too many pattern prefixes for the hashed index");
+
+                seed = random_();
+                if (TryBuild(buckets_count, seed))
+                    break;
+
+                if (attempt % 2 == 0)
+                    buckets_count *= 2;
+            }
+
+            std::vector<uint32_t> slots(keys_slots_.size() * 4);
+            for (size_t i = 0; i < keys_slots_.size(); ++i) {
+                slots[i * 4] = static_cast<uint32_t>(keys_slots_[i]);
+                slots[i * 4 + 1] = static_cast<uint32_t>(keys_slots_[i] >> 32);
+                slots[i * 4 + 2] = group_slots_[i];
+            }
+            return slots;
+        }
+
+    private:
+        static constexpr size_t max_kicks = 500;
+
+        bool TryBuild(size_t buckets_count, uint64_t seed) {
+            keys_slots_.assign(buckets_count * PatternDatabase::bucket_slots, 0);
+            group_slots_.assign(buckets_count * PatternDatabase::bucket_slots, 0);
+
+            for (size_t group = 0; group < keys_.size(); ++group)
+                if (!Insert(keys_[group], static_cast<uint32_t>(group + 1), buckets_count, seed))
+                    return false;
+            return true;
+        }
+
+        bool Insert(uint64_t key, uint32_t group, size_t buckets_count, uint64_t seed) {
+            for (size_t kick = 0; kick < max_kicks; ++kick) {
+                const auto [first, second] = PatternDatabase::GetHashBuckets(key, seed, buckets_count);
+
+                for (const auto bucket : {first, second})
+                    for (size_t s = 0; s < PatternDatabase::bucket_slots; ++s) {
+                        const size_t slot = bucket * PatternDatabase::bucket_slots + s;
+                        if (!group_slots_[slot]) {
+                            keys_slots_[slot] = key;
+                            group_slots_[slot] = group;
+                            return true;
+                        }
+                    }
+
+                const auto bucket = random_() & 1 ? first : second;
+                const size_t slot = bucket * PatternDatabase::bucket_slots + random_() % PatternDatabase::bucket_slots;
+                std::swap(key, keys_slots_[slot]);
+                std::swap(group, group_slots_[slot]);
+            }
+            return false;
+        }
+
+        const std::vector<uint64_t>& keys_;
+        std::vector<uint64_t> keys_slots_;
+        std::vector<uint32_t> group_slots_;
+        std::mt19937_64 random_{20240917}; // fixed, so the same patterns always compile to the same image
+    };
+
+    [[noreturn]] void Corrupted(const std::string& what) {
+        throw std::runtime_error("Corrupted pattern database: " + what);
+    }
+}
+
+PatternDatabase::PatternDatabase(const std::vector<std::string>& patterns) {
+
+    if (patterns.size() >= std::numeric_limits<uint32_t>::max())
+        throw std::length_error("Too many patterns for 32-bit ids");
+
+    size_t bytes_count = 0;
+    for (const auto& pat : patterns)
+        bytes_count += pat.size();
+
+    if (bytes_count > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("Patterns are too long for 32-bit offsets");
+
+    // patterns of 6 bytes and longer are found by signature: first two bytes select a cell.
+    // Buckets and groups are counted here and filled straight into their sections below, in input order.
+    std::vector<uint32_t> bucket_sizes(cells_count);
+    size_t max_depth = 0, bucketed = 0;
+
+    // hashed index: patterns sharing the whole prefix form a group, groups in order of their first pattern
+    std::unordered_map<uint64_t, uint32_t> group_of;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> group_sizes;
+
+    for (size_t n = 0; n < patterns.size(); ++n) {
+        const auto& pat = patterns[n];
+        if (pat.size() <= 5)
+            continue;
+
+        const size_t depth = ++bucket_sizes[static_cast<unsigned char>(pat[0]) << 8 | static_cast<unsigned char>(pat[1])];
+        max_depth = std::max(max_depth, depth);
+        ++bucketed;
+
+        const auto [it, inserted] = group_of.try_emplace(PackKey(pat), static_cast<uint32_t>(keys.size()));
+        if (inserted) {
+            keys.push_back(it->first);
+            group_sizes.push_back(0);
+        }
+        ++group_sizes[it->second];
+    }
+
+    size_t hash_buckets_count = 0;
+    uint64_t hash_seed = 0;
+    const auto hash_slots = HashTableBuilder(keys).Build(hash_buckets_count, hash_seed);
+
+    std::array<size_t, SectionsCount> sizes{};
+    sizes[PatternOffsets] = (patterns.size() + 1) * sizeof(uint32_t);
+    sizes[PatternBytes] = bytes_count;
+    sizes[BucketOffsets] = (cells_count + 1) * sizeof(uint32_t);
+    sizes[BucketPatterns] = bucketed * sizeof(uint32_t);
+    sizes[BucketEntries] = bucketed * 2 * sizeof(uint32_t);
+    sizes[HashSlots] = hash_slots.size() * sizeof(uint32_t);
+    sizes[GroupOffsets] = (keys.size() + 1) * sizeof(uint32_t);
+    sizes[GroupPatterns] = bucketed * sizeof(uint32_t);
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.byte_order = byte_order_mark;
+    header.alignment = alignment;
+    header.patterns_count = patterns.size();
+    header.max_depth = max_depth;
+    header.hash_buckets_count = hash_buckets_count;
+    header.hash_seed = hash_seed;
+    header.groups_count = keys.size();
+
+    size_t offset = AlignUp(sizeof(Header));
+    for (size_t s = 0; s < SectionsCount; ++s) {
+        header.sections[s] = {offset, sizes[s]};
+        offset += AlignUp(sizes[s]);
+    }
+
+    image_.resize(offset / sizeof(uint32_t));
+    auto* image = reinterpret_cast<char*>(image_.data());
+    std::memcpy(image, &header, sizeof(header));
+
+    auto section = [&](Section s) { return image_.data() + header.sections[s].offset / sizeof(uint32_t); };
+
+    auto* offsets = section(PatternOffsets);
+    auto* bytes = image + header.sections[PatternBytes].offset;
+    for (size_t n = 0, at = 0; n < patterns.size(); ++n) {
+        offsets[n] = static_cast<uint32_t>(at);
+        std::memcpy(bytes + at, patterns[n].data(), patterns[n].size());
+        at += patterns[n].size();
+    }
+    offsets[patterns.size()] = static_cast<uint32_t>(bytes_count);
+
+    auto* bucket_offsets = section(BucketOffsets);
+    auto* bucket_patterns = section(BucketPatterns);
+    auto* bucket_entries = section(BucketEntries);
+
+    auto* group_offsets = section(GroupOffsets);
+    auto* group_patterns = section(GroupPatterns);
+
+    for (size_t cell = 0, at = 0; cell < cells_count; ++cell) {
+        bucket_offsets[cell] = static_cast<uint32_t>(at);
+        at += bucket_sizes[cell];
+    }
+    bucket_offsets[cells_count] = static_cast<uint32_t>(bucketed);
+
+    for (size_t group = 0, at = 0; group < keys.size(); ++group) {
+        group_offsets[group] = static_cast<uint32_t>(at);
+        at += group_sizes[group];
+    }
+    group_offsets[keys.size()] = static_cast<uint32_t>(bucketed);
+
+    // the sizes are reused as fill counters
+    std::fill(bucket_sizes.begin(), bucket_sizes.end(), 0);
+    std::fill(group_sizes.begin(), group_sizes.end(), 0);
+
+    for (size_t n = 0; n < patterns.size(); ++n) {
+        const auto& pat = patterns[n];
+        if (pat.size() <= 5)
+            continue;
+
+        const size_t cell = static_cast<unsigned char>(pat[0]) << 8 | static_cast<unsigned char>(pat[1]);
+        const size_t at = bucket_offsets[cell] + bucket_sizes[cell]++;
+        bucket_patterns[at] = static_cast<uint32_t>(n);
+        bucket_entries[at * 2] = PackTag(pat);
+        bucket_entries[at * 2 + 1] = static_cast<uint32_t>(n + 1);
+
+        const uint32_t group = group_of.find(PackKey(pat))->second;
+        group_patterns[group_offsets[group] + group_sizes[group]++] = static_cast<uint32_t>(n);
+    }
+
+    std::copy(hash_slots.begin(), hash_slots.end(), section(HashSlots));
+
+    Attach(image, offset);
+}
+
+PatternDatabase PatternDatabase::Load(const std::string& filename) {
+
+    PatternDatabase database;
+    database.file_.emplace(filename);
+
+    const auto data = database.file_->view();
+    database.Attach(data.data(), data.size());
+
+    return database;
+}
+
+void PatternDatabase::Save(const std::string& filename) const {
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+        throw std::runtime_error("Can't open file: " + filename);
+
+    out.write(data_, static_cast<std::streamsize>(size_));
+    out.close();
+
+    if (!out)
+        throw std::runtime_error("Can't write file: " + filename);
+}
+
+void PatternDatabase::Attach(const char* data, size_t size) {
+
+    Header header{};
+    if (size < sizeof(header))
+        Corrupted("file is too short");
+    std::memcpy(&header, data, sizeof(header));
+
+    if (std::memcmp(header.magic, magic, sizeof(magic)))
+        throw std::runtime_error("Not a pattern database");
+    if (header.byte_order != byte_order_mark)
+        throw std::runtime_error("Pattern database was written on a host of other byte order");
+    if (header.version != version)
+        throw std::runtime_error("Unsupported pattern database version " + std::to_string(header.version));
+
+    for (const auto& [offset, length] : header.sections)
+        if (offset % alignment || offset > size || length > size - offset)
+            Corrupted("section is out of file");
+
+    const auto words = [&](Section s) { return reinterpret_cast<const uint32_t*>(data + header.sections[s].offset); };
+    const auto count = [&](Section s) { return header.sections[s].size / sizeof(uint32_t); };
+
+    patterns_count_ = header.patterns_count;
+    max_depth_ = header.max_depth;
+
+    if (patterns_count_ >= std::numeric_limits<uint32_t>::max() || count(PatternOffsets) != patterns_count_ + 1)
+        Corrupted("wrong number of pattern offsets");
+    if (count(BucketOffsets) != cells_count + 1)
+        Corrupted("wrong number of bucket offsets");
+    if (max_depth_ > patterns_count_ || count(BucketEntries) != count(BucketPatterns) * 2)
+        Corrupted("wrong size of signature tables");
+
+    hash_buckets_count_ = header.hash_buckets_count;
+    hash_seed_ = header.hash_seed;
+    groups_count_ = header.groups_count;
+
+    if (!hash_buckets_count_ || hash_buckets_count_ > max_hash_buckets || hash_buckets_count_ & (hash_buckets_count_ - 1)
+        || count(HashSlots) != hash_buckets_count_ * bucket_slots * 4)
+        Corrupted("wrong size of hashed index");
+    if (groups_count_ > patterns_count_ || count(GroupOffsets) != groups_count_ + 1)
+        Corrupted("wrong number of group offsets");
+
+    pattern_offsets_ = words(PatternOffsets);
+    pattern_bytes_ = std::string_view(data + header.sections[PatternBytes].offset, header.sections[PatternBytes].size);
+    bucket_offsets_ = words(BucketOffsets);
+    bucket_patterns_ = words(BucketPatterns);
+    bucket_entries_ = words(BucketEntries);
+    hash_slots_ = words(HashSlots);
+    group_offsets_ = words(GroupOffsets);
+    group_patterns_ = words(GroupPatterns);
+
+    // everything the device indexes with is checked, so a broken file can't make kernels read out of buffers
+    if (pattern_offsets_[0] || pattern_offsets_[patterns_count_] != pattern_bytes_.size()
+        || !std::is_sorted(pattern_offsets_, pattern_offsets_ + patterns_count_ + 1))
+        Corrupted("wrong pattern offsets");
+
+    if (bucket_offsets_[0] || bucket_offsets_[cells_count] != count(BucketPatterns)
+        || !std::is_sorted(bucket_offsets_, bucket_offsets_ + cells_count + 1))
+        Corrupted("wrong bucket offsets");
+
+    for (size_t i = 0; i < count(BucketPatterns); ++i)
+        if (bucket_patterns_[i] >= patterns_count_ || GetPattern(bucket_patterns_[i]).size() <= 5)
+            Corrupted("wrong bucket index");
+
+    size_t max_depth = 0;
+    for (size_t cell = 0; cell < cells_count; ++cell)
+        max_depth = std::max<size_t>(max_depth, bucket_offsets_[cell + 1] - bucket_offsets_[cell]);
+    if (max_depth != max_depth_)
+        Corrupted("wrong depth of signature tables");
+
+    for (size_t i = 0; i < count(BucketPatterns); ++i)
+        if (bucket_entries_[i * 2 + 1] != bucket_patterns_[i] + 1)
+            Corrupted("wrong signature tables");
+
+    for (size_t i = 0; i < count(HashSlots); i += 4)
+        if (hash_slots_[i + 2] > groups_count_)
+            Corrupted("wrong hashed index");
+
+    if (group_offsets_[0] || group_offsets_[groups_count_] != count(GroupPatterns)
+        || !std::is_sorted(group_offsets_, group_offsets_ + groups_count_ + 1))
+        Corrupted("wrong group offsets");
+
+    for (size_t i = 0; i < count(GroupPatterns); ++i)
+        if (group_patterns_[i] >= patterns_count_ || GetPattern(group_patterns_[i]).size() <= 5)
+            Corrupted("wrong group index");
+
+    data_ = data;
+    size_ = size;
+}
+
+std::string_view PatternDatabase::GetPattern(size_t i) const noexcept {
+    return pattern_bytes_.substr(pattern_offsets_[i], pattern_offsets_[i + 1] - pattern_offsets_[i]);
+}
+
+std::vector<std::string> PatternDatabase::GetPatterns() const {
+
+    std::vector<std::string> patterns;
+    patterns.reserve(patterns_count_);
+
+    for (size_t i = 0; i < patterns_count_; ++i)
+        patterns.emplace_back(GetPattern(i));
+
+    return patterns;
+}
+
+uint32_t PatternDatabase::PackTag(std::string_view pat) noexcept {
+    return static_cast<uint32_t>(static_cast<unsigned char>(pat[2]))
+         | static_cast<uint32_t>(static_cast<unsigned char>(pat[3])) << 8
+         | static_cast<uint32_t>(static_cast<unsigned char>(pat[4])) << 16
+         | static_cast<uint32_t>(static_cast<unsigned char>(pat[5])) << 24;
+}
+
+std::span<const uint32_t> PatternDatabase::GetBucket(size_t cell) const noexcept {
+    return {bucket_patterns_ + bucket_offsets_[cell], bucket_patterns_ + bucket_offsets_[cell + 1]};
+}
+
+std::span<const uint32_t> PatternDatabase::GetGroup(size_t group) const noexcept {
+    return {group_patterns_ + group_offsets_[group], group_patterns_ + group_offsets_[group + 1]};
+}
+
+std::pair<uint32_t, uint32_t> PatternDatabase::GetHashBuckets(uint64_t key, uint64_t seed, size_t buckets_count) noexcept {
+
+    const auto mask = static_cast<uint32_t>(buckets_count - 1);
+
+    uint64_t hash = (key ^ seed) * 0x9E3779B97F4A7C15ull;
+    const auto first = static_cast<uint32_t>(hash >> 40) & mask;
+
+    hash = (hash ^ hash >> 29) * 0xBF58476D1CE4E5B9ull;
+    const auto second = static_cast<uint32_t>(hash >> 40) & mask;
+
+    return {first, second};
+}
+
+uint32_t PatternDatabase::FindGroup(std::string_view prefix) const noexcept {
+
+    if (prefix.size() < prefix_size)
+        return 0;
+
+    const uint64_t key = PackKey(prefix);
+    const auto [first, second] = GetHashBuckets(key, hash_seed_, hash_buckets_count_);
+
+    for (const auto bucket : {first, second})
+        for (size_t s = 0; s < bucket_slots; ++s) {
+            const uint32_t* slot = hash_slots_ + (bucket * bucket_slots + s) * 4;
+            if (slot[2] && slot[0] == static_cast<uint32_t>(key) && slot[1] == static_cast<uint32_t>(key >> 32))
+                return slot[2];
+        }
+
+    return 0;
+}
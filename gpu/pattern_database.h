@@ -0,0 +1,110 @@
+#pragma once
+
+#include "../io/mapped_file.h"
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Compiled pattern set: everything PatternMatchingGPU derives from the patterns before matching.
+// It is one image of page-aligned sections behind a versioned header. The image is either compiled
+// in memory or mapped from a file written by Save, so a database file is loaded without any
+// preprocessing and its tables go to the device straight from the mapping.
+class PatternDatabase final {
+public:
+    static constexpr uint32_t version = 3;
+    static constexpr size_t cells_count = 256 * 256; // signature cells: first two bytes of a pattern
+    static constexpr size_t prefix_size = 6;         // bytes matched by the signature or the hashed index
+    static constexpr size_t bucket_slots = 4;        // slots in a bucket of the hashed index
+
+    explicit PatternDatabase(const std::vector<std::string>& patterns);
+
+    // accessors point into the image, so the database is only moved
+    PatternDatabase(const PatternDatabase&) = delete;
+    PatternDatabase& operator=(const PatternDatabase&) = delete;
+    PatternDatabase(PatternDatabase&&) noexcept = default;
+    PatternDatabase& operator=(PatternDatabase&&) noexcept = default;
+
+    // maps a file written by Save, throws std::runtime_error if it isn't a valid database of this version
+    static PatternDatabase Load(const std::string& filename);
+    void Save(const std::string& filename) const;
+
+    size_t GetPatternsCount() const noexcept { return patterns_count_; }
+    std::string_view GetPattern(size_t i) const noexcept;
+    std::vector<std::string> GetPatterns() const;
+
+    std::string_view GetPatternBytes() const noexcept { return pattern_bytes_; } // all patterns back to back
+    const uint32_t* GetPatternOffsets() const noexcept { return pattern_offsets_; } // GetPatternsCount() + 1
+
+    // most patterns sharing one cell, the number of signature tables
+    size_t GetMaxDepth() const noexcept { return max_depth_; }
+
+    // bucket index: patterns longer than 5 bytes that start with bytes (cell >> 8, cell & 0xFF), in input order
+    std::span<const uint32_t> GetBucket(size_t cell) const noexcept;
+
+    // cells_count + 1 offsets of the buckets into the bucket index, the CSR of the signature tables
+    const uint32_t* GetBucketOffsets() const noexcept { return bucket_offsets_; }
+    // signature entries in the order of the bucket index, two words each: bytes 2-5 of the pattern packed
+    // little-endian and its index + 1; the k-th pattern of a cell is at GetBucketOffsets()[cell] + k
+    const uint32_t* GetBucketEntries() const noexcept { return bucket_entries_; }
+
+    // tag of a pattern longer than 5 bytes in the signature tables
+    static uint32_t PackTag(std::string_view pat) noexcept;
+
+    // Hashed index: every distinct 6-byte prefix of the patterns longer than 5 bytes is a key of a bucketed
+    // cuckoo table and leads to the group of patterns starting with it. A key sits in one of its two buckets
+    // (GetHashBuckets), so a text position is checked against every pattern with a few loads whatever the depth.
+    // A slot is 4 words: key bytes 0-3 and 4-5 packed little-endian, group + 1 (0 for an empty slot) and 0.
+    size_t GetHashBucketsCount() const noexcept { return hash_buckets_count_; } // power of 2
+    uint64_t GetHashSeed() const noexcept { return hash_seed_; }
+    const uint32_t* GetHashSlots() const noexcept { return hash_slots_; }
+
+    size_t GetGroupsCount() const noexcept { return groups_count_; }
+    const uint32_t* GetGroupOffsets() const noexcept { return group_offsets_; } // GetGroupsCount() + 1
+    const uint32_t* GetGroupPatterns() const noexcept { return group_patterns_; }
+    std::span<const uint32_t> GetGroup(size_t group) const noexcept; // patterns of the group, in input order
+
+    // the two buckets of a key (prefix bytes 0-5 little-endian), the same function as hash_buckets in match.cl
+    static std::pair<uint32_t, uint32_t> GetHashBuckets(uint64_t key, uint64_t seed, size_t buckets_count) noexcept;
+
+    // group + 1 of the patterns starting with prefix, 0 if there are none
+    uint32_t FindGroup(std::string_view prefix) const noexcept;
+
+private:
+    enum Section {
+        PatternOffsets, PatternBytes, BucketOffsets, BucketPatterns, BucketEntries,
+        HashSlots, GroupOffsets, GroupPatterns, SectionsCount
+    };
+
+    struct Header;
+
+    PatternDatabase() = default;
+
+    // checks the image and points the section accessors into it
+    void Attach(const char* data, size_t size);
+
+    std::vector<uint32_t> image_; // compiled in memory,
+    std::optional<MappedFile> file_; // or mapped from a file
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+
+    size_t patterns_count_ = 0;
+    size_t max_depth_ = 0;
+    std::string_view pattern_bytes_;
+    const uint32_t* pattern_offsets_ = nullptr;
+    const uint32_t* bucket_offsets_ = nullptr;
+    const uint32_t* bucket_patterns_ = nullptr;
+    const uint32_t* bucket_entries_ = nullptr;
+
+    size_t hash_buckets_count_ = 0;
+    uint64_t hash_seed_ = 0;
+    const uint32_t* hash_slots_ = nullptr;
+    size_t groups_count_ = 0;
+    const uint32_t* group_offsets_ = nullptr;
+    const uint32_t* group_patterns_ = nullptr;
+};
@@ -0,0 +1,166 @@
+#include "program_cache.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+    constexpr char magic[4] = {'P', 'M', 'C', 'L'};
+
+    // FNV-1a, names cache entries; collisions are caught by the key stored inside the entry
+    uint64_t Hash(const std::string& data) {
+        uint64_t hash = 14695981039346656037ull;
+        for (const auto c : data) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string ToHex(uint64_t value) {
+        std::ostringstream out;
+        out << std::hex << value;
+        return out.str();
+    }
+
+    std::filesystem::path FromEnvironment(const char* name) {
+        const char* value = std::getenv(name);
+        return value ? value : std::filesystem::path();
+    }
+}
+
+ProgramCache::ProgramCache(std::filesystem::path directory) : directory_(std::move(directory)) {}
+
+std::filesystem::path ProgramCache::GetDefaultDirectory() {
+
+    if (std::getenv("PATTERN_MATCHING_CACHE_DIR"))
+        return FromEnvironment("PATTERN_MATCHING_CACHE_DIR");
+
+    if (auto cache = FromEnvironment("XDG_CACHE_HOME"); !cache.empty())
+        return cache / "pattern-matching";
+
+    if (auto home = FromEnvironment("HOME"); !home.empty())
+        return home / ".cache" / "pattern-matching";
+
+    return {};
+}
+
+cl::Program ProgramCache::Build(const cl::Context& context, const cl::Device& device,
+                                const std::string& source, const std::string& options) const {
+
+    const std::string key = GetKey(device, source, options);
+    const auto path = directory_.empty() ? directory_ : directory_ / (ToHex(Hash(key)) + ".bin");
+
+    if (!path.empty())
+        if (auto program = Load(context, device, key, path, options); program())
+            return program;
+
+    cl::Program program(context, source);
+    if (program.build({device}, options.c_str()) != CL_SUCCESS)
+        throw std::runtime_error("Can't build OpenCL program:\n" + program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
+
+    if (!path.empty())
+        Store(program, key, path);
+
+    return program;
+}
+
+std::string ProgramCache::GetKey(const cl::Device& device, const std::string& source, const std::string& options) {
+
+    std::ostringstream key;
+    key << "device: " << device.getInfo<CL_DEVICE_NAME>() << '\n'
+        << "vendor: " << device.getInfo<CL_DEVICE_VENDOR>() << '\n'
+        << "version: " << device.getInfo<CL_DEVICE_VERSION>() << '\n'
+        << "driver: " << device.getInfo<CL_DRIVER_VERSION>() << '\n'
+        << "options: " << options << '\n'
+        << "source: " << source.size() << ' ' << ToHex(Hash(source)) << '\n';
+
+    return key.str();
+}
+
+cl::Program ProgramCache::Load(const cl::Context& context, const cl::Device& device, const std::string& key,
+                               const std::filesystem::path& path, const std::string& options) const {
+
+    // entry: magic, key size, key, binary
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+        return {};
+
+    const std::string entry((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const size_t header_size = sizeof(magic) + sizeof(uint32_t);
+
+    if (entry.size() < header_size || entry.compare(0, sizeof(magic), magic, sizeof(magic)))
+        return {};
+
+    uint32_t key_size = 0;
+    entry.copy(reinterpret_cast<char*>(&key_size), sizeof(key_size), sizeof(magic));
+
+    if (entry.size() - header_size < key_size || entry.compare(header_size, key_size, key))
+        return {};
+
+    const char* binary = entry.data() + header_size + key_size;
+    const size_t binary_size = entry.size() - header_size - key_size;
+
+    std::vector<cl_int> status;
+    cl_int err = CL_SUCCESS;
+    cl::Program program(context, {device}, {{binary, binary_size}}, &status, &err);
+
+    // a driver may still reject the binary, then the source is built again
+    if (err != CL_SUCCESS || status.empty() || status[0] != CL_SUCCESS)
+        return {};
+    if (program.build({device}, options.c_str()) != CL_SUCCESS)
+        return {};
+
+    return program;
+}
+
+void ProgramCache::Store(const cl::Program& program, const std::string& key, const std::filesystem::path& path) const {
+
+    // the program is built for one device, so it has one binary
+    size_t binary_size = 0;
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, nullptr) != CL_SUCCESS
+        || !binary_size)
+        return;
+
+    std::vector<unsigned char> binary(binary_size);
+    unsigned char* binaries[] = {binary.data()};
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(binaries), binaries, nullptr) != CL_SUCCESS)
+        return;
+
+    // the cache only saves time, so a directory that can't be written just leaves it empty
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    if (error)
+        return;
+
+    // written aside and renamed, so concurrent runs never read a half-written entry
+    auto temp = path;
+    temp += ".tmp" + std::to_string(::getpid());
+
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        const auto key_size = static_cast<uint32_t>(key.size());
+
+        out.write(magic, sizeof(magic));
+        out.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+        out.write(key.data(), static_cast<std::streamsize>(key.size()));
+        out.write(reinterpret_cast<const char*>(binary.data()), static_cast<std::streamsize>(binary.size()));
+
+        if (!out) {
+            out.close();
+            std::filesystem::remove(temp, error);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temp, path, error);
+    if (error)
+        std::filesystem::remove(temp, error);
+}
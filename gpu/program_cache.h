@@ -0,0 +1,36 @@
+#pragma once
+
+#ifdef __APPLE__
+#include <OpenCL/cl.hpp>
+#else
+#include <CL/cl.hpp>
+#endif
+
+#include <filesystem>
+#include <string>
+
+// Built OpenCL programs kept on disk, so later runs load the device binary instead of compiling the source.
+// An entry is keyed by everything the binary depends on: device, driver version, build options and source.
+// The whole key is stored in the entry and compared on load, a stale or broken entry is just rebuilt.
+class ProgramCache final {
+public:
+    // empty directory disables the cache
+    explicit ProgramCache(std::filesystem::path directory);
+
+    // $PATTERN_MATCHING_CACHE_DIR if set, otherwise pattern-matching in $XDG_CACHE_HOME or ~/.cache
+    static std::filesystem::path GetDefaultDirectory();
+
+    // program built for the device, from a cached binary if there is one;
+    // throws std::runtime_error with the build log if the source doesn't build
+    cl::Program Build(const cl::Context& context, const cl::Device& device,
+                      const std::string& source, const std::string& options) const;
+
+private:
+    static std::string GetKey(const cl::Device& device, const std::string& source, const std::string& options);
+
+    cl::Program Load(const cl::Context& context, const cl::Device& device, const std::string& key,
+                     const std::filesystem::path& path, const std::string& options) const;
+    void Store(const cl::Program& program, const std::string& key, const std::filesystem::path& path) const;
+
+    std::filesystem::path directory_;
+};
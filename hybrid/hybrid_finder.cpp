@@ -0,0 +1,70 @@
+#include "hybrid_finder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+
+namespace {
+
+    std::vector<double> ValidShares(double device_share) {
+        if (!(device_share >= 0 && device_share <= 1))
+            throw std::invalid_argument("Device share must be within [0, 1]");
+        return {device_share, 1 - device_share};
+    }
+}
+
+PatternMatchingHybrid::PatternMatchingHybrid(const std::vector<std::string>& patterns)
+    : PatternMatchingHybrid(patterns, Options{}) {}
+
+PatternMatchingHybrid::PatternMatchingHybrid(const std::vector<std::string>& patterns, const Options& options)
+    : cpu_(patterns, PatternMatchingCPU::Engine::AhoCorasick, options.threads), gpu_(patterns, options.gpu),
+      split_(ValidShares(options.device_share)) {
+
+    for (const auto& pat : patterns)
+        max_length_ = std::max(max_length_, pat.size());
+}
+
+std::vector<size_t> PatternMatchingHybrid::Match(std::string_view text, size_t& time) const {
+
+    auto start_time = std::chrono::system_clock::now();
+
+    const size_t split = split_.Split(text.size())[0];
+
+    // the device reads up to max_length_ - 1 bytes past the split to verify the matches starting before it,
+    // the CPU counts only matches lying wholly after the split, so every match is counted once
+    const auto device_text = text.substr(0, std::min(text.size(), split + std::max<size_t>(max_length_, 1) - 1));
+    const auto host_text = text.substr(split);
+
+    std::vector<size_t> device_res;
+    size_t device_time = 0;
+
+    // the device thread mostly waits on the queue, while the calling thread works in the CPU pool
+    auto device = std::async(std::launch::async, [&] {
+        auto begin = std::chrono::system_clock::now();
+        size_t kernel_time = 0;
+        device_res = gpu_.Match(device_text, split, kernel_time);
+        device_time = (std::chrono::system_clock::now() - begin).count();
+    });
+
+    auto begin = std::chrono::system_clock::now();
+    size_t count_time = 0;
+    auto res = cpu_.GetCounts(host_text, count_time);
+    const size_t host_time = (std::chrono::system_clock::now() - begin).count();
+
+    device.get();
+
+    for (size_t i = 0; i < res.size(); ++i)
+        res[i] += device_res[i];
+
+    split_.Update({split, host_text.size()}, {device_time, host_time});
+
+    auto finish_time = std::chrono::system_clock::now();
+    time = (finish_time - start_time).count();
+
+    return res;
+}
+
+double PatternMatchingHybrid::GetDeviceShare() const {
+    return split_.GetShares()[0];
+}
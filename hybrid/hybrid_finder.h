@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../cpu/cpu_finder.h"
+#include "../gpu/gpu_finder.h"
+#include "throughput_split.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Splits a text between the OpenCL device and the CPU workers, which run at the same time:
+// the device counts matches starting in the prefix, Aho-Corasick counts the ones in the rest.
+// The split follows the throughput both engines showed on the previous texts.
+class PatternMatchingHybrid final {
+public:
+    struct Options {
+        size_t threads = 0;        // CPU workers, 0 means one per hardware thread
+        double device_share = 0.5; // part of the first text given to the device, before anything is measured
+        PatternMatchingGPU::Options gpu;
+    };
+
+    explicit PatternMatchingHybrid(const std::vector<std::string>& patterns);
+    PatternMatchingHybrid(const std::vector<std::string>& patterns, const Options& options);
+
+    std::vector<size_t> Match(std::string_view text, size_t& time) const;
+
+    // part of the next text that goes to the device
+    double GetDeviceShare() const;
+
+private:
+    PatternMatchingCPU cpu_;
+    PatternMatchingGPU gpu_;
+    size_t max_length_ = 0;
+
+    mutable ThroughputSplit split_; // device part first
+};
@@ -0,0 +1,75 @@
+#include "multi_device_finder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+
+namespace {
+
+    std::vector<cl::Device> GetDevices(cl_device_type type) {
+        auto devices = PatternMatchingGPU::GetDevices(type);
+        if (devices.empty())
+            throw std::invalid_argument("No devices found");
+        return devices;
+    }
+}
+
+PatternMatchingMultiDevice::PatternMatchingMultiDevice(const std::vector<std::string>& patterns)
+    : PatternMatchingMultiDevice(patterns, Options{}) {}
+
+PatternMatchingMultiDevice::PatternMatchingMultiDevice(const std::vector<std::string>& patterns, const Options& options)
+    : PatternMatchingMultiDevice(patterns, options.gpu, GetDevices(options.device_type)) {}
+
+PatternMatchingMultiDevice::PatternMatchingMultiDevice(const std::vector<std::string>& patterns,
+                                                       const PatternMatchingGPU::Options& options,
+                                                       const std::vector<cl::Device>& devices)
+    : split_(std::vector<double>(devices.size(), 1.0)) {
+
+    const auto database = std::make_shared<const PatternDatabase>(patterns);
+
+    for (const auto& device : devices)
+        devices_.push_back(std::make_unique<PatternMatchingGPU>(database, device, options));
+
+    for (const auto& pat : patterns)
+        max_length_ = std::max(max_length_, pat.size());
+}
+
+std::vector<size_t> PatternMatchingMultiDevice::Match(std::string_view text, size_t& time) const {
+
+    auto start_time = std::chrono::system_clock::now();
+
+    const auto parts = split_.Split(text.size());
+    std::vector<size_t> times(devices_.size());
+
+    // a shard holds max_length_ - 1 bytes past its range to verify the matches starting in the range,
+    // and counts only those, so every match is counted by exactly one device
+    const size_t overlap = std::max<size_t>(max_length_, 1) - 1;
+
+    std::vector<std::future<std::vector<size_t>>> shards;
+    for (size_t k = 0, begin = 0; k < devices_.size(); begin += parts[k++]) {
+        const auto shard = text.substr(begin, std::min(text.size(), begin + parts[k] + overlap) - begin);
+
+        shards.push_back(std::async(std::launch::async, [this, &times, k, shard, limit = parts[k]] {
+            auto begin = std::chrono::system_clock::now();
+            size_t kernel_time = 0;
+            auto res = devices_[k]->Match(shard, limit, kernel_time);
+            times[k] = (std::chrono::system_clock::now() - begin).count();
+            return res;
+        }));
+    }
+
+    auto res = shards[0].get();
+    for (size_t k = 1; k < shards.size(); ++k) {
+        const auto shard_res = shards[k].get();
+        for (size_t i = 0; i < res.size(); ++i)
+            res[i] += shard_res[i];
+    }
+
+    split_.Update(parts, times);
+
+    auto finish_time = std::chrono::system_clock::now();
+    time = (finish_time - start_time).count();
+
+    return res;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "../gpu/gpu_finder.h"
+#include "throughput_split.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One pattern set on every OpenCL device at once, across platforms. Each device has its own context,
+// queue and copy of the tables; they share the compiled database on the host. A text is cut into shards,
+// one per device, sized by the throughput the devices showed on the previous texts.
+class PatternMatchingMultiDevice final {
+public:
+    struct Options {
+        cl_device_type device_type = CL_DEVICE_TYPE_ALL;
+        PatternMatchingGPU::Options gpu;
+    };
+
+    explicit PatternMatchingMultiDevice(const std::vector<std::string>& patterns);
+    PatternMatchingMultiDevice(const std::vector<std::string>& patterns, const Options& options);
+
+    std::vector<size_t> Match(std::string_view text, size_t& time) const;
+
+    size_t GetDevicesCount() const noexcept { return devices_.size(); }
+
+    // part of the next text that goes to every device
+    std::vector<double> GetShares() const { return split_.GetShares(); }
+
+private:
+    PatternMatchingMultiDevice(const std::vector<std::string>& patterns, const PatternMatchingGPU::Options& options,
+                               const std::vector<cl::Device>& devices);
+
+    std::vector<std::unique_ptr<PatternMatchingGPU>> devices_;
+    size_t max_length_ = 0;
+
+    mutable ThroughputSplit split_;
+};
@@ -0,0 +1,68 @@
+#include "throughput_split.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+ThroughputSplit::ThroughputSplit(std::vector<double> shares) : shares_(std::move(shares)), rates_(shares_.size()) {
+
+    const double total = std::accumulate(shares_.begin(), shares_.end(), 0.0);
+
+    if (shares_.empty() || !(total > 0) || std::any_of(shares_.begin(), shares_.end(), [](double s) { return !(s >= 0); }))
+        throw std::invalid_argument("Shares must be non-negative and not all zero");
+
+    for (auto& share : shares_)
+        share /= total;
+}
+
+std::vector<size_t> ThroughputSplit::Split(size_t size) const {
+
+    std::lock_guard lock(mutex_);
+
+    // parts end at rounded cumulative shares, so they always add up to size
+    std::vector<size_t> parts(shares_.size());
+    double cumulative = 0;
+    size_t begin = 0;
+
+    for (size_t k = 0; k < shares_.size(); ++k) {
+        cumulative += shares_[k];
+        const size_t end = k + 1 == shares_.size() ? size
+                         : std::min(size, static_cast<size_t>(static_cast<double>(size) * cumulative + 0.5));
+        parts[k] = std::max(end, begin) - begin;
+        begin = std::max(end, begin);
+    }
+
+    return parts;
+}
+
+void ThroughputSplit::Update(const std::vector<size_t>& bytes, const std::vector<size_t>& times) {
+
+    std::lock_guard lock(mutex_);
+
+    for (size_t k = 0; k < rates_.size(); ++k) {
+        if (!bytes[k])
+            continue;
+        const double latest = static_cast<double>(bytes[k]) / static_cast<double>(std::max<size_t>(times[k], 1));
+        rates_[k] = rates_[k] ? smoothing_ * latest + (1 - smoothing_) * rates_[k] : latest;
+    }
+
+    if (std::find(rates_.begin(), rates_.end(), 0.0) != rates_.end())
+        return;
+
+    // all engines finish together when each one gets a part proportional to its throughput
+    const double total = std::accumulate(rates_.begin(), rates_.end(), 0.0);
+    double clamped = 0;
+    for (size_t k = 0; k < rates_.size(); ++k) {
+        shares_[k] = std::max(rates_[k] / total, min_share_);
+        clamped += shares_[k];
+    }
+
+    for (auto& share : shares_)
+        share /= clamped;
+}
+
+std::vector<double> ThroughputSplit::GetShares() const {
+
+    std::lock_guard lock(mutex_);
+    return shares_;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Divides a text between engines in proportion to the throughput each of them showed on the previous texts,
+// so that all of them finish at about the same time.
+class ThroughputSplit final {
+public:
+    // shares used until every engine has been measured, normalized to sum to 1
+    explicit ThroughputSplit(std::vector<double> shares);
+
+    // bytes of a text of `size` bytes for every engine, in order; they sum to size
+    std::vector<size_t> Split(size_t size) const;
+
+    // engine k took times[k] clock ticks for bytes[k] bytes; engines given no bytes keep their throughput
+    void Update(const std::vector<size_t>& bytes, const std::vector<size_t>& times);
+
+    std::vector<double> GetShares() const;
+
+private:
+    // no engine is left without work, so every one keeps being measured
+    static constexpr double min_share_ = 0.02;
+    // weight of the latest text in the measured throughput
+    static constexpr double smoothing_ = 0.5;
+
+    mutable std::mutex mutex_;
+    std::vector<double> shares_;
+    std::vector<double> rates_; // bytes per clock tick, 0 until measured
+};
@@ -0,0 +1,66 @@
+#include "input.h"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace {
+
+    // the same reading rules as ReadString on std::istream
+    class Reader final {
+    public:
+        explicit Reader(std::string_view data) : data_(data) {}
+
+        size_t ReadNumber() {
+
+            while (pos_ < data_.size() && std::isspace(static_cast<unsigned char>(data_[pos_])))
+                ++pos_;
+
+            if (pos_ == data_.size() || !std::isdigit(static_cast<unsigned char>(data_[pos_])))
+                throw std::runtime_error("Wrong input format: number expected at byte " + std::to_string(pos_));
+
+            size_t number = 0;
+            for (; pos_ < data_.size() && std::isdigit(static_cast<unsigned char>(data_[pos_])); ++pos_)
+                number = number * 10 + (data_[pos_] - '0');
+
+            return number;
+        }
+
+        // length, one separator byte, the string itself and one more separator byte
+        std::string_view ReadString() {
+
+            const size_t size = ReadNumber();
+            if (!size)
+                return {};
+
+            if (data_.size() - pos_ < size + 1)
+                throw std::runtime_error("Wrong input format: string of " + std::to_string(size) + " bytes is cut off");
+
+            const auto str = data_.substr(pos_ + 1, size);
+            pos_ = std::min(data_.size(), pos_ + size + 2);
+
+            return str;
+        }
+
+    private:
+        std::string_view data_;
+        size_t pos_ = 0;
+    };
+}
+
+Input ParseInput(std::string_view data) {
+
+    Reader reader(data);
+
+    Input input;
+    input.text = reader.ReadString();
+
+    const size_t num_of_pat = reader.ReadNumber();
+    // every pattern takes at least a byte, so a broken count can't make reserve explode
+    input.patterns.reserve(std::min(num_of_pat, data.size()));
+
+    for (size_t i = 0; i < num_of_pat; ++i)
+        input.patterns.emplace_back(reader.ReadString());
+
+    return input;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Matching task in the input format from README: text length and text,
+// number of patterns, then every pattern as its length and bytes.
+struct Input final {
+    std::string_view text; // points into the parsed data, nothing is copied
+    std::vector<std::string> patterns;
+};
+
+// parses data in place, so the text stays valid as long as data does
+Input ParseInput(std::string_view data);
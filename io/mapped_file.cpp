@@ -0,0 +1,69 @@
+#include "mapped_file.h"
+
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& filename) {
+
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "Can't open file: " + filename);
+
+    struct stat info{};
+    if (::fstat(fd, &info) < 0) {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "Can't stat file: " + filename);
+    }
+
+    size_ = static_cast<size_t>(info.st_size);
+
+    // mmap of zero bytes fails, an empty file is just an empty view
+    if (size_) {
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "Can't map file: " + filename);
+        }
+
+        // the file is read front to back once
+        ::madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(data);
+    }
+
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    Unmap();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+
+    if (this != &other) {
+        Unmap();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+void MappedFile::Unmap() noexcept {
+
+    if (data_)
+        ::munmap(const_cast<char*>(data_), size_);
+
+    data_ = nullptr;
+    size_ = 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file.
+// Views into the file stay valid while the object lives, the pages are read in by the OS on first access.
+class MappedFile final {
+public:
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    std::string_view view() const noexcept { return {data_, size_}; }
+
+private:
+    void Unmap() noexcept;
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,69 @@
+#include "test_generator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+TestCase GenerateTest(const TestGenInfo& info) {
+
+    const unsigned seed = info.seed ? info.seed : std::chrono::steady_clock::now().time_since_epoch().count();
+    std::default_random_engine eng(seed);
+    std::uniform_int_distribution<int> distr1(info.min_value, info.max_value);
+    std::uniform_int_distribution<int> distr2(info.min_p, info.max_p);
+
+    const size_t depth = std::max<size_t>(info.prefix_depth, 1);
+
+    TestCase test;
+
+    test.text.resize(info.size);
+    for (auto& c : test.text)
+        c = static_cast<char>(distr1(eng));
+
+    std::bernoulli_distribution from_text(std::clamp(info.from_text, 0.0, 1.0));
+
+    test.patterns.reserve(info.size_of_pat.size());
+    for (const auto size : info.size_of_pat) {
+        std::string pat(size, 0);
+        for (auto& c : pat)
+            c = static_cast<char>(distr2(eng));
+
+        // the group's first pattern sets the two bytes, so up to prefix_depth patterns collide in one cell
+        const size_t group_start = test.patterns.size() / depth * depth;
+        const bool grouped = group_start < test.patterns.size() && size >= 2 && test.patterns[group_start].size() >= 2;
+        if (grouped)
+            pat.replace(0, 2, test.patterns[group_start], 0, 2);
+
+        // a pattern cut from the text starts with the group's bytes too, when the text has them
+        if (size && size <= test.text.size() && from_text(eng)) {
+            size_t at = std::uniform_int_distribution<size_t>(0, test.text.size() - size)(eng);
+            if (grouped) {
+                at = test.text.find(pat.substr(0, 2), at);
+                if (at == std::string::npos)
+                    at = test.text.find(pat.substr(0, 2));
+            }
+            if (at != std::string::npos && at + size <= test.text.size())
+                pat = test.text.substr(at, size);
+        }
+
+        test.patterns.push_back(std::move(pat));
+    }
+
+    return test;
+}
+
+void TestGenerator(const std::vector<TestGenInfo>& files) {
+
+    for (const auto& file : files) {
+        const auto test = GenerateTest(file);
+
+        std::ofstream ostr(file.name);
+        if (!ostr.is_open())
+            throw std::runtime_error("Can't open file: " + file.name);
+
+        ostr << test.text.size() << " " << test.text << "\n" << test.patterns.size() << "\n";
+        for (const auto& pat : test.patterns)
+            ostr << pat.size() << " " << pat << "\n";
+    }
+}
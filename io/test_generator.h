@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+//info for generating tests
+struct TestGenInfo final {
+    std::string name;
+    size_t size;
+    char min_value, max_value; // for string
+    std::vector<size_t> size_of_pat;
+    char min_p, max_p; //for patterns
+    size_t prefix_depth = 1; // patterns go in groups of this many sharing their first two bytes, i.e. one table cell
+    double from_text = 0;    // share of patterns cut from the text, so that they surely match
+    unsigned seed = 0;       // 0 takes the seed from the clock
+};
+
+// text and patterns of a test, generated in memory
+struct TestCase final {
+    std::string text;
+    std::vector<std::string> patterns;
+};
+
+TestCase GenerateTest(const TestGenInfo& info);
+
+// writes every test to its file name, in the input format from README
+void TestGenerator(const std::vector<TestGenInfo>& files);
@@ -1,6 +1,11 @@
 #include <iostream>
+#include <cstring>
 #include "gpu/gpu_finder.h"
 #include "cpu/cpu_finder.h"
+#include "hybrid/hybrid_finder.h"
+#include "hybrid/multi_device_finder.h"
+#include "io/input.h"
+#include "io/mapped_file.h"
 
 std::string ReadString(std::istream& in) {
 
@@ -18,9 +23,94 @@ std::string ReadString(std::istream& in) {
     return str;
 }
 
-int main() {
+std::vector<std::string> ReadPatterns(std::istream& in) {
+
+    size_t num_of_pat = 0;
+    in >> num_of_pat;
+
+    std::vector<std::string> patterns;
+    patterns.reserve(num_of_pat);
+
+    for (size_t i = 0; i < num_of_pat; ++i)
+        patterns.push_back(ReadString(in));
+
+    return patterns;
+}
+
+void PrintCounts(const std::vector<size_t>& counts) {
+
+    for (size_t i = 0; i < counts.size(); ++i)
+        std::cout << i + 1 << " " << counts[i] << '\n';
+}
+
+// PatternMatching --stream <text file>: only the patterns are read from stdin,
+// the text file is matched chunk by chunk and is never loaded into memory as a whole
+int MatchStream(const char* filename) {
+
+    std::ifstream text(filename, std::ios::binary);
+    if (!text.is_open())
+        throw std::runtime_error(std::string("Can't open file: ") + filename);
+
+    PatternMatchingGPU Finder(ReadPatterns(std::cin));
+
+    PrintCounts(Finder.MatchStream(text));
+    return 0;
+}
+
+// PatternMatching <input file>: the same input as on stdin, but mapped into memory
+// and matched in place, so the text is never copied on the host;
+// PatternMatching --hybrid <input file>: the text is split between the device and the CPU threads;
+// PatternMatching --all-devices <input file>: the text is sharded between all OpenCL devices of all platforms
+template <typename Finder>
+int MatchFile(const char* filename) {
+
+    const MappedFile file(filename);
+    const auto [text, patterns] = ParseInput(file.view());
+
+    Finder finder(patterns);
+    size_t time = 0;
+
+    PrintCounts(finder.Match(text, time));
+    return 0;
+}
+
+// PatternMatching --compile <database file>: offline step, patterns from stdin are compiled into
+// a database file; no OpenCL device is needed
+int CompileDatabase(const char* filename) {
+
+    PatternDatabase(ReadPatterns(std::cin)).Save(filename);
+    return 0;
+}
+
+// PatternMatching --database <database file> <text file>: patterns come precompiled,
+// the text file holds just the text and is matched in place
+int MatchWithDatabase(const char* database, const char* filename) {
+
+    PatternMatchingGPU Finder(PatternDatabase::Load(database));
+
+    const MappedFile text(filename);
+    size_t time = 0;
+
+    PrintCounts(Finder.Match(text.view(), time));
+    return 0;
+}
+
+int main(int argc, char** argv) {
 
     try {
+        if (argc == 3 && !std::strcmp(argv[1], "--stream"))
+            return MatchStream(argv[2]);
+        if (argc == 3 && !std::strcmp(argv[1], "--hybrid"))
+            return MatchFile<PatternMatchingHybrid>(argv[2]);
+        if (argc == 3 && !std::strcmp(argv[1], "--all-devices"))
+            return MatchFile<PatternMatchingMultiDevice>(argv[2]);
+        if (argc == 3 && !std::strcmp(argv[1], "--compile"))
+            return CompileDatabase(argv[2]);
+        if (argc == 4 && !std::strcmp(argv[1], "--database"))
+            return MatchWithDatabase(argv[2], argv[3]);
+        if (argc == 2)
+            return MatchFile<PatternMatchingGPU>(argv[1]);
+
         std::istream& in = std::cin;
 /*      std::ifstream in("tests//my_test.txt");
         if (!in.is_open())
@@ -28,24 +118,12 @@ int main() {
 
         const std::string text = ReadString(in);
 
-        size_t num_of_pat = 0;
-        in >> num_of_pat;
-
-        std::vector<std::string> patterns;
-        patterns.reserve(num_of_pat);
-
-
-        for (int i = 0; i < num_of_pat; ++i) {
-            const std::string pat = ReadString(in);
-            patterns.push_back(pat);
-        }
+        const auto patterns = ReadPatterns(in);
 
         PatternMatchingGPU Finder(patterns);
         size_t time = 0;
 
-        auto result = Finder.Match(text, time);
-        for (int i = 0; i < result.size(); ++i)
-            std::cout << i + 1 << " " << result[i] << std::endl;
+        PrintCounts(Finder.Match(text, time));
 
     } catch (std::exception& e) {
         std::cerr<<e.what()<<std::endl;
@@ -1,37 +1,30 @@
 #include "gpu/gpu_finder.h"
 #include "cpu/cpu_finder.h"
+#include "hybrid/hybrid_finder.h"
+#include "hybrid/multi_device_finder.h"
+#include "gpu/Matrix/Matrix.h"
+#include "gpu/Matrix/PinnedAllocator.h"
+#include "io/input.h"
+#include "io/mapped_file.h"
+#include "io/test_generator.h"
+#include <algorithm>
+#include <cassert>
 #include <set>
 #include <random>
 
 #include <filesystem>
 std::vector<std::string> GetAllTestFileNames(const std::string& dirname);
 
-
-//info for generating tests
-struct TestGenInfo final {
-    std::string name;
-    size_t size;
-    char min_value, max_value; // for string
-    std::vector<size_t> size_of_pat;
-    char min_p, max_p; //for patterns
-};
-void TestGenerator(const std::vector<TestGenInfo>& files);
-
-std::string ReadString(std::istream& in) {
-
-    long size = 0;
-    in >> size;
-    if (!size)
-        return {};
-
-    std::string str;
-    str.resize(size);
-    in.ignore(1);
-    in.read(str.data(), size);
-    in.ignore();
-
-    return str;
-}
+bool CompareResults(const std::string& filename, const std::string& engine,
+                    const std::vector<size_t>& expected, const std::vector<size_t>& actual);
+bool CheckTiming(const std::string& filename, const PatternMatchingGPU::Timing& timing);
+void PrintTiming(const std::string& title, const PatternMatchingGPU::Timing& timing);
+bool TestShortPatterns();
+bool TestBinaryData();
+bool TestAllocators();
+bool TestPositions();
+bool TestCountersWrap();
+bool TestBatchHits();
 
 int main () {
 
@@ -40,56 +33,198 @@ int main () {
 
         for (const auto &filename : filenames) {
 
-            std::ifstream in(filename);
-            if (!in.is_open())
-                throw std::runtime_error("Can't open file: " + filename);
-
-            const std::string text = ReadString(in);
-
-            size_t num_of_pat = 0;
-            in >> num_of_pat;
-
-            std::vector<std::string> patterns;
-            patterns.reserve(num_of_pat);
-
-            for (int i = 0; i < num_of_pat; ++i) {
-                const std::string pat = ReadString(in);
-                patterns.push_back(pat);
-            }
+            // the text is matched right in the mapped file, without copies
+            const MappedFile file(filename);
+            const auto [text, patterns] = ParseInput(file.view());
 
             size_t cpu_time = 0;
             PatternMatchingCPU cpu(patterns);
             auto cpu_result = cpu.GetCounts(text, cpu_time);
 
+            size_t ac_time = 0;
+            PatternMatchingCPU ac(patterns, PatternMatchingCPU::Engine::AhoCorasick);
+            auto ac_result = ac.GetCounts(text, ac_time);
+
+            size_t parallel_time = 0;
+            PatternMatchingCPU parallel(patterns, PatternMatchingCPU::Engine::AhoCorasick, 0);
+            auto parallel_result = parallel.GetCounts(text, parallel_time);
+
             size_t gpu_time = 0;
             PatternMatchingGPU gpu(patterns);
             auto gpu_result = gpu.Match(text, gpu_time);
 
-            assert(cpu_result.size() == gpu_result.size());
-
-            bool res = true;
-            for (size_t i = 0; i < cpu_result.size(); ++i) {
-                if (cpu_result[i] != gpu_result[i]) {
-                    std::cerr<<"Wrong answer in test: "<<filename<<std::endl;
-                    for (int j = 0; j < cpu_result.size(); ++j)
-                        std::cout << j << " cpu: " << cpu_result[j] << " | " << "gpu: " << gpu_result[j] << std::endl;
-
-                    res = false;
-                    i = cpu_result.size();
-                    std::cout<<"\n";
-
-                }
+            // second call runs on the buffers pooled by the first one
+            size_t gpu_reuse_time = 0;
+            auto gpu_reuse_result = gpu.Match(text, gpu_reuse_time);
+
+            // small odd chunks, so that many matches cross the chunk boundaries
+            size_t longest = 0;
+            for (const auto& pat : patterns)
+                longest = std::max(longest, pat.size());
+
+            std::istringstream text_stream{std::string(text)};
+            auto gpu_stream_result = gpu.MatchStream(text_stream, longest + 4093);
+
+            // the text cut into packet-sized pieces, matched as one batch
+            std::vector<std::string_view> packets;
+            for (size_t at = 0; at < text.size(); at += 1500)
+                packets.push_back(text.substr(at, 1500));
+
+            size_t gpu_batch_time = 0;
+            auto gpu_batch_result = gpu.MatchBatch(packets, gpu_batch_time);
+
+            // offsets of every match, counted back per pattern
+            size_t gpu_positions_time = 0;
+            std::vector<size_t> gpu_positions_result(patterns.size());
+            for (const auto& position : gpu.MatchPositions(text, gpu_positions_time))
+                ++gpu_positions_result[position.pattern];
+
+            // the same patterns compiled into a database file and mapped back
+            const auto database_file = std::filesystem::temp_directory_path() / "pattern_matching_tests.pmdb";
+            PatternDatabase(patterns).Save(database_file);
+
+            size_t gpu_database_time = 0;
+            PatternMatchingGPU gpu_database(PatternDatabase::Load(database_file));
+            auto gpu_database_result = gpu_database.Match(text, gpu_database_time);
+            std::filesystem::remove(database_file);
+
+            // the first instance stores the built program in an empty cache, the second one loads it from there
+            PatternMatchingGPU::Options cached;
+            cached.program_cache = std::filesystem::temp_directory_path() / "pattern_matching_tests_cache";
+            std::filesystem::remove_all(cached.program_cache);
+            { PatternMatchingGPU warm_up(patterns, cached); }
+
+            size_t gpu_cached_time = 0;
+            PatternMatchingGPU gpu_cached(patterns, cached);
+            auto gpu_cached_result = gpu_cached.Match(text, gpu_cached_time);
+            std::filesystem::remove_all(cached.program_cache);
+
+            size_t gpu_host_time = 0;
+            PatternMatchingGPU gpu_host(patterns, {PatternMatchingGPU::Verification::Host});
+            auto gpu_host_result = gpu_host.Match(text, gpu_host_time);
+
+            // 16 positions per work-item, the text read through a local-memory tile
+            PatternMatchingGPU::Options tiled;
+            tiled.positions_per_item = 16;
+
+            size_t gpu_tiled_time = 0;
+            PatternMatchingGPU gpu_tiled(patterns, tiled);
+            auto gpu_tiled_result = gpu_tiled.Match(text, gpu_tiled_time);
+
+            tiled.verification = PatternMatchingGPU::Verification::Host;
+            size_t gpu_tiled_host_time = 0;
+            PatternMatchingGPU gpu_tiled_host(patterns, tiled);
+            auto gpu_tiled_host_result = gpu_tiled_host.Match(text, gpu_tiled_host_time);
+
+            // one launch of the hashed index instead of a launch per signature table
+            size_t gpu_hash_time = 0;
+            PatternMatchingGPU gpu_hash(patterns, {PatternMatchingGPU::Verification::Device, PatternMatchingGPU::Index::Hash});
+            auto gpu_hash_result = gpu_hash.Match(text, gpu_hash_time);
+
+            size_t gpu_hash_host_time = 0;
+            PatternMatchingGPU gpu_hash_host(patterns, {PatternMatchingGPU::Verification::Host, PatternMatchingGPU::Index::Hash});
+            auto gpu_hash_host_result = gpu_hash_host.Match(text, gpu_hash_host_time);
+
+            // the same call broken into device commands and host stages
+            PatternMatchingGPU::Timing gpu_host_timing;
+            auto gpu_profiled_result = gpu_host.Match(text, gpu_host_timing);
+
+            // every third pattern is removed and added again twice, under new ids at the end:
+            // the first copy takes the removed entry, the second grows the cell and moves the ones after it
+            size_t gpu_updated_time = 0;
+            PatternMatchingGPU gpu_updated(patterns);
+            std::vector<size_t> removed_ids;
+            std::vector<std::string> readded;
+            for (size_t i = 0; i < patterns.size(); i += 3) {
+                removed_ids.push_back(i);
+                readded.push_back(patterns[i]);
             }
+            gpu_updated.RemovePatterns(removed_ids);
+            gpu_updated.AddPatterns(readded);
+            gpu_updated.AddPatterns(readded);
+            auto gpu_updated_result = gpu_updated.Match(text, gpu_updated_time);
+
+            auto updated_result = cpu_result;
+            for (size_t copy = 0; copy < 2; ++copy)
+                for (const auto id : removed_ids)
+                    updated_result.push_back(cpu_result[id]);
+            for (const auto id : removed_ids)
+                updated_result[id] = 0;
+
+            // the second text is split by the throughput measured on the first one
+            size_t hybrid_time = 0;
+            PatternMatchingHybrid hybrid(patterns);
+            auto hybrid_result = hybrid.Match(text, hybrid_time);
+            auto hybrid_adapted_result = hybrid.Match(text, hybrid_time);
+
+            // every device gets a shard, sized by the throughput measured on the first call
+            size_t multi_time = 0;
+            PatternMatchingMultiDevice multi(patterns);
+            auto multi_result = multi.Match(text, multi_time);
+            auto multi_adapted_result = multi.Match(text, multi_time);
+
+            bool res = CompareResults(filename, "aho-corasick", cpu_result, ac_result);
+            res = CompareResults(filename, "parallel aho-corasick", cpu_result, parallel_result) && res;
+            res = CompareResults(filename, "gpu", cpu_result, gpu_result) && res;
+            res = CompareResults(filename, "gpu (reused session)", cpu_result, gpu_reuse_result) && res;
+            res = CompareResults(filename, "gpu (stream)", cpu_result, gpu_stream_result) && res;
+
+            bool batch_res = true;
+            for (size_t k = 0; k < packets.size() && batch_res; ++k) {
+                size_t packet_time = 0;
+                batch_res = CompareResults(filename, "gpu (batch)", ac.GetCounts(packets[k], packet_time), gpu_batch_result[k]);
+            }
+            res = batch_res && res;
+
+            res = CompareResults(filename, "gpu (positions)", cpu_result, gpu_positions_result) && res;
+            res = CompareResults(filename, "gpu (database file)", cpu_result, gpu_database_result) && res;
+            res = CompareResults(filename, "gpu (cached program)", cpu_result, gpu_cached_result) && res;
+            res = CompareResults(filename, "gpu (host verification)", cpu_result, gpu_host_result) && res;
+            res = CompareResults(filename, "gpu (profiled)", cpu_result, gpu_profiled_result) && res;
+            res = CheckTiming(filename, gpu_host_timing) && res;
+            res = CompareResults(filename, "gpu (tiled)", cpu_result, gpu_tiled_result) && res;
+            res = CompareResults(filename, "gpu (tiled, host verification)", cpu_result, gpu_tiled_host_result) && res;
+            res = CompareResults(filename, "gpu (hashed index)", cpu_result, gpu_hash_result) && res;
+            res = CompareResults(filename, "gpu (hashed index, host verification)", cpu_result, gpu_hash_host_result) && res;
+            res = CompareResults(filename, "gpu (updated patterns)", updated_result, gpu_updated_result) && res;
+            res = CompareResults(filename, "hybrid", cpu_result, hybrid_result) && res;
+            res = CompareResults(filename, "hybrid (adapted split)", cpu_result, hybrid_adapted_result) && res;
+            res = CompareResults(filename, "all devices", cpu_result, multi_result) && res;
+            res = CompareResults(filename, "all devices (adapted split)", cpu_result, multi_adapted_result) && res;
 
             if (res) {
                 std::cout << "-------------Test: " << filename << " ----------\n";
                 std::cout << "size of test: " << text.size() << std::endl;
                 std::cout << "CPU time: " << cpu_time << std::endl;
-                std::cout << "GPU time: " << gpu_time << "\n" << std::endl;
+                std::cout << "Aho-Corasick time: " << ac_time << std::endl;
+                std::cout << "Parallel Aho-Corasick time: " << parallel_time << std::endl;
+                std::cout << "GPU time: " << gpu_time << std::endl;
+                std::cout << "GPU time (reused session): " << gpu_reuse_time << std::endl;
+                std::cout << "GPU time (batch of " << packets.size() << " texts): " << gpu_batch_time << std::endl;
+                std::cout << "GPU time (database file): " << gpu_database_time << std::endl;
+                std::cout << "GPU time (host verification): " << gpu_host_time << std::endl;
+                PrintTiming("GPU stages (host verification)", gpu_host_timing);
+                std::cout << "GPU time (tiled): " << gpu_tiled_time << std::endl;
+                std::cout << "GPU time (tiled, host verification): " << gpu_tiled_host_time << std::endl;
+                std::cout << "GPU time (hashed index): " << gpu_hash_time << std::endl;
+                std::cout << "GPU time (hashed index, host verification): " << gpu_hash_host_time << std::endl;
+                std::cout << "Hybrid time: " << hybrid_time << " (device share " << hybrid.GetDeviceShare() << ")" << std::endl;
+                std::cout << "All devices time: " << multi_time << " (" << multi.GetDevicesCount() << " devices)\n" << std::endl;
             }
-
-            in.close();
         }
+
+        if (TestShortPatterns())
+            std::cout << "-------------Test: short patterns ----------\n" << std::endl;
+        if (TestBinaryData())
+            std::cout << "-------------Test: binary data ----------\n" << std::endl;
+        if (TestCountersWrap())
+            std::cout << "-------------Test: counters wrap ----------\n" << std::endl;
+        if (TestPositions())
+            std::cout << "-------------Test: positions ----------\n" << std::endl;
+        if (TestBatchHits())
+            std::cout << "-------------Test: batch hits ----------\n" << std::endl;
+        if (TestAllocators())
+            std::cout << "-------------Test: allocators ----------\n" << std::endl;
     } catch (std::exception& e) {
         std::cerr<<e.what()<<std::endl;
         exit(1);
@@ -106,50 +241,381 @@ int main () {
     return 0;
 }
 
-std::vector<std::string> GetAllTestFileNames(const std::string& dirname) {
+bool CompareResults(const std::string& filename, const std::string& engine,
+                    const std::vector<size_t>& expected, const std::vector<size_t>& actual) {
 
-    std::vector<std::string> filenames;
+    assert(expected.size() == actual.size());
 
-    std::filesystem::directory_iterator p(dirname);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (expected[i] != actual[i]) {
+            std::cerr<<"Wrong answer in test: "<<filename<<" ("<<engine<<")"<<std::endl;
+            for (int j = 0; j < expected.size(); ++j)
+                std::cout << j << " cpu: " << expected[j] << " | " << engine << ": " << actual[j] << std::endl;
 
-    for (const auto & it : p) {
-        if (!std::filesystem::is_regular_file(it.status()))
-            continue;
+            std::cout<<"\n";
+            return false;
+        }
+    }
 
-        filenames.push_back(it.path().string());
+    return true;
+}
+
+bool CheckTiming(const std::string& filename, const PatternMatchingGPU::Timing& timing) {
+
+    // the text is uploaded or wrapped, then every table is matched and read back
+    bool ok = std::any_of(timing.stages.begin(), timing.stages.end(), [](const auto& stage) { return stage.name == "match"; });
+    for (const auto& stage : timing.stages)
+        ok = ok && stage.queued <= stage.submit && stage.submit <= stage.start && stage.start <= stage.end;
+
+    if (!ok)
+        std::cerr << "Wrong timing in test: " << filename << " (" << timing.stages.size() << " stages)" << std::endl;
+    return ok;
+}
+
+void PrintTiming(const std::string& title, const PatternMatchingGPU::Timing& timing) {
+
+    // device time of the stages with the same name, all tables together
+    std::vector<std::pair<std::string, cl_ulong>> totals;
+    for (const auto& stage : timing.stages) {
+        auto it = std::find_if(totals.begin(), totals.end(), [&](const auto& total) { return total.first == stage.name; });
+        if (it == totals.end())
+            it = totals.insert(totals.end(), {stage.name, 0});
+        it->second += stage.end - stage.start;
     }
-    return filenames;
+
+    std::cout << title << ":";
+    for (const auto& [name, time] : totals)
+        std::cout << " " << name << " " << time << ",";
+    std::cout << " short patterns " << timing.short_patterns << ", verification " << timing.verification << std::endl;
 }
 
-void TestGenerator(const std::vector<TestGenInfo>& files) {
+bool TestShortPatterns() {
 
-    for (const auto& file : files) {
-        unsigned seed = std::chrono::steady_clock::now().time_since_epoch().count();
-        std::default_random_engine eng(seed);
-        std::uniform_int_distribution<int> distr1(file.min_value, file.max_value);
-        std::uniform_int_distribution<int> distr2(file.min_p, file.max_p);
+    const std::string filename = "short patterns";
 
-        std::ofstream ostr(file.name);
-        if (!ostr.is_open()) {
-            std::cerr << "Cant open input file!" << std::endl;
-            exit(0);
-        }
-        ostr<<file.size<<" "<<std::endl;
-        for (int i = 0; i < file.size; ++i) {
-            char c = distr1(eng);
-            ostr<<c;
+    // no pattern is longer than 5 bytes, so there are no signature tables and short_count does all the counting
+    std::mt19937 gen(7);
+    std::string text(100000, 0);
+    for (auto& c : text)
+        c = static_cast<char>('a' + gen() % 4);
+
+    std::vector<std::string> patterns = {"a", "ab", "abc", "dcba", "abcda", "ab", "ddddd", "c"};
+
+    size_t time = 0;
+    const auto cpu_result = PatternMatchingCPU(patterns).GetCounts(text, time);
+
+    // pieces of the text as a batch: matches across the pieces aren't counted
+    const PatternMatchingCPU cpu(patterns);
+    std::vector<std::string_view> pieces;
+    std::vector<size_t> pieces_result(patterns.size());
+    for (size_t at = 0; at < text.size(); at += 999) {
+        pieces.push_back(std::string_view(text).substr(at, 999));
+        const auto piece_result = cpu.GetCounts(pieces.back(), time);
+        for (size_t i = 0; i < patterns.size(); ++i)
+            pieces_result[i] += piece_result[i];
+    }
+
+    bool res = true;
+    for (const auto index : {PatternMatchingGPU::Index::Table, PatternMatchingGPU::Index::Hash}) {
+        const bool hashed = index == PatternMatchingGPU::Index::Hash;
+
+        PatternMatchingGPU gpu(patterns, {PatternMatchingGPU::Verification::Device, index});
+        res = CompareResults(filename, hashed ? "gpu (hashed index)" : "gpu", cpu_result, gpu.Match(text, time)) && res;
+
+        std::istringstream text_stream(text);
+        res = CompareResults(filename, hashed ? "gpu (hashed index, stream)" : "gpu (stream)", cpu_result,
+                             gpu.MatchStream(text_stream, 4096)) && res;
+
+        std::vector<size_t> positions_result(patterns.size());
+        for (const auto& position : gpu.MatchPositions(text, time))
+            ++positions_result[position.pattern];
+        res = CompareResults(filename, hashed ? "gpu (hashed index, positions)" : "gpu (positions)", cpu_result,
+                             positions_result) && res;
+
+        std::vector<size_t> batch_result(patterns.size());
+        for (const auto& hit : gpu.MatchBatchHits(pieces, time))
+            batch_result[hit.pattern] += hit.count;
+        res = CompareResults(filename, hashed ? "gpu batch (hashed index)" : "gpu batch", pieces_result,
+                             batch_result) && res;
+
+        PatternMatchingGPU gpu_host(patterns, {PatternMatchingGPU::Verification::Host, index});
+        res = CompareResults(filename, hashed ? "gpu (hashed index, host verification)" : "gpu (host verification)",
+                             cpu_result, gpu_host.Match(text, time)) && res;
+    }
+
+    // the first long pattern adds the first table
+    PatternMatchingGPU gpu_updated(patterns);
+    gpu_updated.AddPatterns({"abcdabcd"});
+
+    auto updated_patterns = patterns;
+    updated_patterns.push_back("abcdabcd");
+    const auto updated_result = PatternMatchingCPU(updated_patterns).GetCounts(text, time);
+    res = CompareResults(filename, "gpu (updated patterns)", updated_result, gpu_updated.Match(text, time)) && res;
+
+    // empty patterns match nowhere, in a stream as well
+    const std::vector<std::string> empty_patterns(2);
+    std::istringstream empty_stream(text);
+    res = CompareResults(filename, "gpu (empty patterns, stream)", std::vector<size_t>(2),
+                         PatternMatchingGPU(empty_patterns).MatchStream(empty_stream, 4096)) && res;
+
+    return res;
+}
+
+bool TestBinaryData() {
+
+    const std::string filename = "binary data";
+
+    // runs of NULs and bytes from 0x80 up, which a signed char or a C string would break
+    std::mt19937 gen(13);
+    std::string text(200000, 0);
+    for (auto& c : text) {
+        const auto r = gen() % 8;
+        c = static_cast<char>(r < 3 ? 0 : r < 6 ? 0x80 + gen() % 128 : gen() % 256);
+    }
+    text.replace(1000, 16, std::string(16, '\0'));
+    text.replace(5000, 10, "\xff\xfe\xfd\0\0\x80\x81\0\xff\xfe", 10);
+
+    std::vector<std::string> patterns = {
+        std::string("\0\0\0\0\0\0\0", 7),
+        std::string("\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 16),
+        std::string("\xff\xfe\xfd\0\0\x80\x81\0\xff\xfe", 10),
+        std::string("\xff\xfe\xfd\0\0\x80", 6),
+        std::string("\0\0\x80\x81\0\xff", 6),
+        std::string("\x80\x80\x80\x80\x80\x80\x80", 7),
+        std::string("\0", 1),
+        std::string("\0\0", 2),
+        std::string("\xff\0\xff", 3),
+        std::string("\x80\0\0\x80\0", 5),
+    };
+
+    // pieces of the text, so that the long patterns of random bytes have matches too
+    for (size_t at = 20000; at < text.size(); at += 20000)
+        patterns.push_back(text.substr(at, 6 + at / 20000 % 20));
+
+    size_t time = 0;
+    const auto cpu_result = PatternMatchingCPU(patterns).GetCounts(text, time);
+
+    bool res = true;
+    for (const auto index : {PatternMatchingGPU::Index::Table, PatternMatchingGPU::Index::Hash}) {
+        const bool hashed = index == PatternMatchingGPU::Index::Hash;
+
+        PatternMatchingGPU gpu(patterns, {PatternMatchingGPU::Verification::Device, index});
+        res = CompareResults(filename, hashed ? "gpu (hashed index)" : "gpu", cpu_result, gpu.Match(text, time)) && res;
+
+        PatternMatchingGPU gpu_host(patterns, {PatternMatchingGPU::Verification::Host, index});
+        res = CompareResults(filename, hashed ? "gpu (hashed index, host verification)" : "gpu (host verification)",
+                             cpu_result, gpu_host.Match(text, time)) && res;
+    }
+
+    return res;
+}
+
+bool TestCountersWrap() {
+
+    const std::string filename = "counters wrap";
+
+    // the 32-bit device counters start a few matches below 2^32, as if a long stream had filled them,
+    // so that they wrap around in the first chunk
+    std::mt19937 gen(19);
+    std::string text(50000, 0);
+    for (auto& c : text)
+        c = static_cast<char>(gen() % 5 ? 'a' : 'b');
+
+    const std::vector<std::string> patterns = {"a", "ab", "aaa", "aaaaaaa", "aaaaab", "b", "aaaaaaaaaaaaa"};
+
+    size_t time = 0;
+    const auto cpu_result = PatternMatchingCPU(patterns).GetCounts(text, time);
+
+    bool res = true;
+    for (const auto index : {PatternMatchingGPU::Index::Table, PatternMatchingGPU::Index::Hash}) {
+        const bool hashed = index == PatternMatchingGPU::Index::Hash;
+
+        PatternMatchingGPU gpu(patterns, {PatternMatchingGPU::Verification::Device, index});
+        gpu.counts_start_ = std::numeric_limits<cl_uint>::max() - 3;
+
+        res = CompareResults(filename, hashed ? "gpu (hashed index)" : "gpu", cpu_result, gpu.Match(text, time)) && res;
+
+        std::istringstream text_stream(text);
+        res = CompareResults(filename, hashed ? "gpu (hashed index, stream)" : "gpu (stream)", cpu_result,
+                             gpu.MatchStream(text_stream, 4096)) && res;
+    }
+
+    return res;
+}
+
+bool TestPositions() {
+
+    const std::string filename = "positions";
+    bool res = true;
+    auto check = [&res, &filename](bool ok, const std::string& what) {
+        if (!ok)
+            std::cerr << "Wrong positions in test: " << filename << " (" << what << ")" << std::endl;
+        res = ok && res;
+    };
+
+    std::mt19937 gen(17);
+    std::string text(30000, 0);
+    for (auto& c : text)
+        c = static_cast<char>('a' + gen() % 3);
+
+    // short and long patterns, overlapping matches, patterns given twice and one that never matches
+    const std::vector<std::string> patterns = {"ab", "abc", "aaa", "abcabc", "cabacab", "abcabc", "aaaaaaaaaaaaaaaaaaaa",
+                                               text.substr(100, 12), text.substr(20000, 9), "c", "abc"};
+
+    // every offset of every pattern, found one by one
+    std::vector<std::pair<size_t, size_t>> expected; // (offset, pattern)
+    for (size_t i = 0; i < patterns.size(); ++i)
+        for (size_t at = text.find(patterns[i]); at != std::string::npos; at = text.find(patterns[i], at + 1))
+            expected.push_back({at, i});
+    std::sort(expected.begin(), expected.end());
+
+    auto to_pairs = [](const std::vector<PatternMatchingGPU::Position>& positions) {
+        std::vector<std::pair<size_t, size_t>> pairs;
+        for (const auto& position : positions)
+            pairs.push_back({position.offset, position.pattern});
+        return pairs;
+    };
+
+    for (const auto index : {PatternMatchingGPU::Index::Table, PatternMatchingGPU::Index::Hash}) {
+        const std::string name = index == PatternMatchingGPU::Index::Hash ? "hashed index" : "table index";
+        PatternMatchingGPU gpu(patterns, {PatternMatchingGPU::Verification::Device, index});
+        size_t time = 0;
+
+        bool overflow = true;
+        check(to_pairs(gpu.MatchPositions(text, time, 0, &overflow)) == expected && !overflow, name);
+
+        // a cap above the matches returns all of them
+        check(to_pairs(gpu.MatchPositions(text, time, expected.size(), &overflow)) == expected && !overflow,
+              name + ", cap of every match");
+
+        // a cap below the matches: that many real positions, no position twice, and the overflow flag
+        const size_t cap = expected.size() / 3;
+        const auto capped = to_pairs(gpu.MatchPositions(text, time, cap, &overflow));
+
+        bool real = std::is_sorted(capped.begin(), capped.end())
+                    && std::adjacent_find(capped.begin(), capped.end()) == capped.end();
+        for (const auto& pair : capped)
+            real = real && std::binary_search(expected.begin(), expected.end(), pair);
+        check(overflow && capped.size() == cap && real, name + ", cap below the matches");
+    }
+
+    return res;
+}
+
+bool TestBatchHits() {
+
+    const std::string filename = "batch hits";
+
+    // many small texts with more (text, pattern) pairs than the first hits buffer holds, so that work-groups
+    // run again with a grown one, an empty text and a long one whose counts are summed across work-groups
+    std::mt19937 gen(23);
+    std::vector<std::string> texts(60000);
+    for (auto& text : texts) {
+        text.assign(6 + gen() % 6, 'a');
+        for (auto& c : text)
+            if (gen() % 10 == 0)
+                c = 'b';
+    }
+    texts[100].clear();
+    texts.push_back(std::string(70000, 'a'));
+
+    // patterns given twice, long and short ones, and short ones that would match across the texts' boundaries
+    const std::vector<std::string> patterns = {"aaaaaa", "aaaaaaa", "aaaab", "baaaaa", "aaaaaaaaaaa", "aab", "aaaaaa",
+                                               "b", "ab", "aab", "aa"};
+
+    std::vector<size_t> expected;
+    for (const auto& text : texts)
+        for (const auto& pat : patterns) {
+            size_t count = 0;
+            for (size_t at = text.find(pat); at != std::string::npos; at = text.find(pat, at + 1))
+                ++count;
+            expected.push_back(count);
         }
-        ostr<<"\n"<<file.size_of_pat.size()<<"\n";
 
-        for (auto&& s : file.size_of_pat) {
-            ostr<<s<<" ";
-            for (int i = 0; i < s; ++i) {
-                char c = distr2(eng);
-                ostr<<c;
-            }
-            ostr<<"\n";
+    const std::vector<std::string_view> views(texts.begin(), texts.end());
+
+    bool res = true;
+    for (const auto index : {PatternMatchingGPU::Index::Table, PatternMatchingGPU::Index::Hash}) {
+        const bool hashed = index == PatternMatchingGPU::Index::Hash;
+        PatternMatchingGPU gpu(patterns, {PatternMatchingGPU::Verification::Device, index});
+        size_t time = 0;
+
+        // the second call starts with the grown buffer
+        for (size_t call = 0; call < 2; ++call) {
+            std::vector<size_t> counts;
+            for (const auto& row : gpu.MatchBatch(views, time))
+                counts.insert(counts.end(), row.begin(), row.end());
+            res = CompareResults(filename, hashed ? "gpu batch (hashed index)" : "gpu batch", expected, counts) && res;
         }
+    }
+
+    return res;
+}
+
+bool TestAllocators() {
+
+    bool res = true;
+    auto check = [&res](bool ok, const std::string& what) {
+        if (!ok)
+            std::cerr << "Wrong allocation: " << what << std::endl;
+        res = ok && res;
+    };
+    auto aligned_to = [](const void* ptr, size_t alignment) { return reinterpret_cast<uintptr_t>(ptr) % alignment == 0; };
+
+    const linal::Matrix<char, linal::AlignedAllocator<256>> aligned(3, 5);
+    check(aligned_to(aligned.data(), 256), "aligned allocator");
+
+    const linal::Matrix<double, linal::PageAllocator> paged(100, 100, 1.0, linal::PageAllocator(true));
+    check(aligned_to(paged.data(), 4096) && paged.at(99, 99) == 1.0, "page allocator");
 
-        ostr.close();
+    // full blocks roll over, a buffer bigger than a block gets its own one
+    linal::Arena arena(4096);
+    {
+        const linal::ArenaAllocator alloc(arena);
+        const linal::Matrix<char, linal::ArenaAllocator> first(1, 3000, 'a', alloc);
+        const linal::Matrix<char, linal::ArenaAllocator> second(1, 3000, 'b', alloc);
+        check(arena.GetBlocksCount() == 2, "arena rollover");
+
+        const linal::Matrix<char, linal::ArenaAllocator> big(1, 10000, 'c', alloc);
+        check(arena.GetBlocksCount() == 3 && first.at(0, 2999) == 'a' && second.at(0, 0) == 'b', "arena big buffer");
+    }
+
+    // an alignment wider than the block's own
+    arena.Allocate(8, 8);
+    check(aligned_to(arena.Allocate(64, 1024), 1024), "arena alignment");
+
+    // moved storage takes its allocator along and is freed by it
+    const auto device = PatternMatchingGPU::GetDevices().at(0);
+    const cl::Context context({device});
+    const cl::CommandQueue queue(context, device);
+    const linal::PinnedAllocator first_pinned(context, queue), second_pinned(context, queue);
+
+    const int* moved_data = nullptr;
+    {
+        linal::Matrix<int, linal::PinnedAllocator> moved(10, 10, 1, first_pinned);
+        linal::Matrix<int, linal::PinnedAllocator> target(20, 20, 2, second_pinned);
+        moved_data = moved.data();
+
+        target = std::move(moved);
+        check(target.data() == moved_data && target.GetAllocator().GetBuffer(target.data())()
+              && !second_pinned.GetBuffer(target.data())() && target.at(9, 9) == 1, "moved buffer");
     }
-};
\ No newline at end of file
+    check(!first_pinned.GetBuffer(moved_data)(), "moved buffer release");
+
+    return res;
+}
+
+std::vector<std::string> GetAllTestFileNames(const std::string& dirname) {
+
+    std::vector<std::string> filenames;
+
+    std::filesystem::directory_iterator p(dirname);
+
+    for (const auto & it : p) {
+        if (!std::filesystem::is_regular_file(it.status()))
+            continue;
+
+        filenames.push_back(it.path().string());
+    }
+    return filenames;
+}